@@ -0,0 +1,237 @@
+/**@file
+ *
+ * @brief Scan, connect and discover state machine.
+ */
+#include "sdk_common.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include "nrf_log.h"
+#include "conn_sm.h"
+
+/**@brief Action run on a transition, before the new state is entered. */
+typedef void (*conn_sm_action_t)(conn_sm_evt_t const * p_evt);
+
+/**@brief Transition. A next state of @ref CONN_STATE_NONE keeps the state (the action still
+ *        runs); an entry without action and next state ignores the event. */
+typedef struct
+{
+    conn_state_t     next;   /**< State to enter. Entered again if it is the current one. */
+    conn_sm_action_t action; /**< Optional action. */
+} conn_sm_transition_t;
+
+/**@brief Entry behaviour of a state. */
+typedef struct
+{
+    char const *       p_name;     /**< Name, for the log. */
+    ret_code_t         (*entry)(void); /**< Optional entry action. */
+    conn_sm_evt_type_t fail_evt;   /**< Event raised if the entry action fails. */
+    uint32_t           timeout_ms; /**< State timer, 0 for none. */
+} conn_sm_state_t;
+
+APP_TIMER_DEF(m_state_timer_id);  /**< Timer of the current state. */
+
+static conn_sm_init_t m_actions;            /**< Application actions. */
+static conn_state_t   m_state = CONN_STATE_IDLE; /**< Current state. */
+static uint32_t       m_state_entered;      /**< Time the current state was entered, in microseconds. */
+static uint32_t       m_state_seq;          /**< Incremented on every state entry, discards timers of earlier states. */
+static ble_gap_addr_t m_peer_addr;          /**< Address of the target device. */
+static uint16_t       m_conn_handle = BLE_CONN_HANDLE_INVALID; /**< Handle of the link. */
+static uint64_t       m_time_us[CONN_STATE_COUNT]; /**< Time spent per state before the current entry. */
+static conn_sm_stats_t m_stats;             /**< Entry and ignored event counters. */
+
+static ret_code_t scan_entry(void)
+{
+    m_actions.scan_start();
+    return NRF_SUCCESS;
+}
+
+static ret_code_t connect_entry(void)
+{
+    return m_actions.connect(&m_peer_addr);
+}
+
+static ret_code_t discover_entry(void)
+{
+    return m_actions.discover(m_conn_handle);
+}
+
+static void peer_store(conn_sm_evt_t const * p_evt)
+{
+    m_peer_addr = *p_evt->params.p_peer_addr;
+}
+
+static void conn_handle_store(conn_sm_evt_t const * p_evt)
+{
+    m_conn_handle = p_evt->params.conn_handle;
+}
+
+static void conn_handle_clear(conn_sm_evt_t const * p_evt)
+{
+    m_conn_handle = BLE_CONN_HANDLE_INVALID;
+}
+
+static void connect_cancel(conn_sm_evt_t const * p_evt)
+{
+    UNUSED_RETURN_VALUE(m_actions.connect_cancel());
+}
+
+static void disconnect(conn_sm_evt_t const * p_evt)
+{
+    UNUSED_RETURN_VALUE(m_actions.disconnect(m_conn_handle));
+}
+
+static conn_sm_state_t const m_states[CONN_STATE_COUNT] =
+{
+    [CONN_STATE_NONE]         = {"none",         NULL,           CONN_SM_EVT_NONE,             0},
+    [CONN_STATE_IDLE]         = {"idle",         NULL,           CONN_SM_EVT_NONE,             0},
+    [CONN_STATE_SCANNING]     = {"scanning",     scan_entry,     CONN_SM_EVT_NONE,             0},
+    [CONN_STATE_CONNECTING]   = {"connecting",   connect_entry,  CONN_SM_EVT_CONNECT_FAILED,   CONN_SM_CONNECT_TIMEOUT_MS},
+    [CONN_STATE_DISCOVERING]  = {"discovering",  discover_entry, CONN_SM_EVT_DISCOVERY_FAILED, CONN_SM_DISCOVERY_TIMEOUT_MS},
+    [CONN_STATE_CONNECTED]    = {"connected",    NULL,           CONN_SM_EVT_NONE,             0},
+    [CONN_STATE_RECONNECTING] = {"reconnecting", scan_entry,     CONN_SM_EVT_NONE,             CONN_SM_RECONNECT_WINDOW_MS},
+};
+
+static conn_sm_transition_t const m_transitions[CONN_STATE_COUNT][CONN_SM_EVT_COUNT] =
+{
+    [CONN_STATE_IDLE] =
+    {
+        [CONN_SM_EVT_START]            = {CONN_STATE_SCANNING,     NULL},
+    },
+    [CONN_STATE_SCANNING] =
+    {
+        [CONN_SM_EVT_TARGET_FOUND]     = {CONN_STATE_CONNECTING,   peer_store},
+        [CONN_SM_EVT_SCAN_TIMEOUT]     = {CONN_STATE_SCANNING,     NULL},
+    },
+    [CONN_STATE_CONNECTING] =
+    {
+        [CONN_SM_EVT_CONNECTED]        = {CONN_STATE_DISCOVERING,  conn_handle_store},
+        [CONN_SM_EVT_CONNECT_FAILED]   = {CONN_STATE_SCANNING,     NULL},
+        [CONN_SM_EVT_TIMEOUT]          = {CONN_STATE_SCANNING,     connect_cancel},
+    },
+    [CONN_STATE_DISCOVERING] =
+    {
+        [CONN_SM_EVT_DISCOVERY_DONE]   = {CONN_STATE_CONNECTED,    NULL},
+        [CONN_SM_EVT_DISCOVERY_FAILED] = {CONN_STATE_NONE,         disconnect},
+        [CONN_SM_EVT_TIMEOUT]          = {CONN_STATE_NONE,         disconnect},
+        [CONN_SM_EVT_DISCONNECTED]     = {CONN_STATE_RECONNECTING, conn_handle_clear},
+    },
+    [CONN_STATE_CONNECTED] =
+    {
+        [CONN_SM_EVT_DISCONNECTED]     = {CONN_STATE_RECONNECTING, conn_handle_clear},
+    },
+    [CONN_STATE_RECONNECTING] =
+    {
+        [CONN_SM_EVT_TARGET_FOUND]     = {CONN_STATE_CONNECTING,   peer_store},
+        [CONN_SM_EVT_SCAN_TIMEOUT]     = {CONN_STATE_RECONNECTING, NULL},
+        [CONN_SM_EVT_TIMEOUT]          = {CONN_STATE_SCANNING,     NULL},
+    },
+};
+
+static void state_timeout_handler(void * p_context)
+{
+    // A timer of a state left since it was started is stale.
+    if ((uint32_t)(uintptr_t)p_context == m_state_seq)
+    {
+        conn_sm_evt_t evt = {.type = CONN_SM_EVT_TIMEOUT};
+        conn_sm_evt_put(&evt);
+    }
+}
+
+/**@brief Function for leaving the current state and entering @p state.
+ *
+ * @return Event raised by the entry action, @ref CONN_SM_EVT_NONE if none.
+ */
+static conn_sm_evt_type_t state_enter(conn_state_t state, conn_sm_evt_type_t cause)
+{
+    uint32_t now     = m_actions.timestamp_get();
+    uint32_t elapsed = now - m_state_entered;
+
+    NRF_LOG_INFO("conn sm: %s -> %s after %u us, event %u",
+                 m_states[m_state].p_name, m_states[state].p_name, elapsed, cause);
+
+    m_time_us[m_state] += elapsed;
+    m_state_entered = now;
+    m_state = state;
+    m_state_seq++;
+    m_stats.entries[state]++;
+
+    UNUSED_RETURN_VALUE(app_timer_stop(m_state_timer_id));
+    if (m_states[state].timeout_ms > 0)
+    {
+        APP_ERROR_CHECK(app_timer_start(m_state_timer_id,
+                                        APP_TIMER_TICKS(m_states[state].timeout_ms),
+                                        (void *)(uintptr_t)m_state_seq));
+    }
+
+    if ((m_states[state].entry != NULL) && (m_states[state].entry() != NRF_SUCCESS))
+    {
+        return m_states[state].fail_evt;
+    }
+
+    return CONN_SM_EVT_NONE;
+}
+
+void conn_sm_init(conn_sm_init_t const * p_init)
+{
+    m_actions = *p_init;
+    m_state = CONN_STATE_IDLE;
+    m_state_entered = m_actions.timestamp_get();
+
+    ret_code_t err_code = app_timer_create(&m_state_timer_id, APP_TIMER_MODE_SINGLE_SHOT, state_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
+void conn_sm_evt_put(conn_sm_evt_t const * p_evt)
+{
+    conn_sm_evt_t evt = *p_evt;
+
+    CRITICAL_REGION_ENTER();
+    // Events raised by entry actions are handled here too, without recursion.
+    while (evt.type != CONN_SM_EVT_NONE)
+    {
+        conn_sm_transition_t const * p_transition = &m_transitions[m_state][evt.type];
+
+        if ((p_transition->next == CONN_STATE_NONE) && (p_transition->action == NULL))
+        {
+            m_stats.ignored++;
+            break;
+        }
+        if (p_transition->action != NULL)
+        {
+            p_transition->action(&evt);
+        }
+        if (p_transition->next == CONN_STATE_NONE)
+        {
+            break;
+        }
+        evt.type = state_enter(p_transition->next, evt.type);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+conn_state_t conn_sm_state_get(void)
+{
+    return m_state;
+}
+
+char const * conn_sm_state_name(conn_state_t state)
+{
+    return (state < CONN_STATE_COUNT) ? m_states[state].p_name : "?";
+}
+
+void conn_sm_stats_get(conn_sm_stats_t * p_stats)
+{
+    CRITICAL_REGION_ENTER();
+    *p_stats = m_stats;
+    for (uint32_t i = 0; i < CONN_STATE_COUNT; i++)
+    {
+        uint64_t time_us = m_time_us[i];
+
+        if (i == m_state)
+        {
+            time_us += m_actions.timestamp_get() - m_state_entered;
+        }
+        p_stats->time_ms[i] = (uint32_t)(time_us / 1000);
+    }
+    CRITICAL_REGION_EXIT();
+}
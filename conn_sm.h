@@ -0,0 +1,122 @@
+/**@file
+ *
+ * @brief Scan, connect and discover state machine.
+ *
+ * @details The connection flow is one table of transitions indexed by state and event. Every
+ *          transition is triggered by an event (BLE events, the state timer, failures of the
+ *          entry actions); nothing waits. On entry a state runs its action (start the scan,
+ *          connect, start discovery) and arms its timer. Failures and disconnects lead back to
+ *          scanning at once.
+ *
+ *          The time spent in each state is accumulated and every transition is logged with
+ *          the time spent in the state left.
+ */
+#ifndef CONN_SM_H__
+#define CONN_SM_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+#include "ble_gap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef CONN_SM_CONNECT_TIMEOUT_MS
+#define CONN_SM_CONNECT_TIMEOUT_MS 5000   /**< Time allowed for a connection to be established. */
+#endif
+
+#ifndef CONN_SM_DISCOVERY_TIMEOUT_MS
+#define CONN_SM_DISCOVERY_TIMEOUT_MS 10000 /**< Time allowed for service discovery. */
+#endif
+
+#ifndef CONN_SM_RECONNECT_WINDOW_MS
+#define CONN_SM_RECONNECT_WINDOW_MS 30000  /**< Time after a disconnect that counts as reconnecting. */
+#endif
+
+/**@brief States. */
+typedef enum
+{
+    CONN_STATE_NONE,         /**< Not a state: no transition. */
+    CONN_STATE_IDLE,         /**< Not started. */
+    CONN_STATE_SCANNING,     /**< Scanning for the target device. */
+    CONN_STATE_CONNECTING,   /**< Connection to the target device requested. */
+    CONN_STATE_DISCOVERING,  /**< Connected, discovering the services. */
+    CONN_STATE_CONNECTED,    /**< Connected and discovered. */
+    CONN_STATE_RECONNECTING, /**< Scanning again after the link was lost. */
+    CONN_STATE_COUNT
+} conn_state_t;
+
+/**@brief Events. */
+typedef enum
+{
+    CONN_SM_EVT_NONE,             /**< No event. */
+    CONN_SM_EVT_START,            /**< Start scanning. */
+    CONN_SM_EVT_TARGET_FOUND,     /**< Report from the target device. */
+    CONN_SM_EVT_SCAN_TIMEOUT,     /**< The scan ran out of time. */
+    CONN_SM_EVT_CONNECTED,        /**< Link established. */
+    CONN_SM_EVT_CONNECT_FAILED,   /**< Connect request failed or timed out in the SoftDevice. */
+    CONN_SM_EVT_DISCOVERY_DONE,   /**< Service discovery completed. */
+    CONN_SM_EVT_DISCOVERY_FAILED, /**< Service discovery failed. */
+    CONN_SM_EVT_DISCONNECTED,     /**< Link lost. */
+    CONN_SM_EVT_TIMEOUT,          /**< State timer expired. */
+    CONN_SM_EVT_COUNT
+} conn_sm_evt_type_t;
+
+/**@brief Event. */
+typedef struct
+{
+    conn_sm_evt_type_t type;
+    union
+    {
+        ble_gap_addr_t const * p_peer_addr; /**< @ref CONN_SM_EVT_TARGET_FOUND: address of the target device. */
+        uint16_t               conn_handle; /**< @ref CONN_SM_EVT_CONNECTED: handle of the link. */
+    } params;
+} conn_sm_evt_t;
+
+/**@brief Actions the state machine drives, provided by the application. */
+typedef struct
+{
+    void       (*scan_start)(void);                               /**< Start or restart the scan. */
+    ret_code_t (*connect)(ble_gap_addr_t const * p_peer_addr);    /**< Stop the scan and connect. */
+    ret_code_t (*connect_cancel)(void);                           /**< Cancel the connect request. */
+    ret_code_t (*discover)(uint16_t conn_handle);                 /**< Start service discovery. */
+    ret_code_t (*disconnect)(uint16_t conn_handle);               /**< Disconnect the link. */
+    uint32_t   (*timestamp_get)(void);                            /**< Current time in microseconds. */
+} conn_sm_init_t;
+
+/**@brief Time spent per state. */
+typedef struct
+{
+    uint32_t entries[CONN_STATE_COUNT]; /**< Times each state was entered. */
+    uint32_t time_ms[CONN_STATE_COUNT]; /**< Time spent in each state, in milliseconds. Includes the current state. */
+    uint32_t ignored;                   /**< Events without a transition in the state they arrived in. */
+} conn_sm_stats_t;
+
+/**@brief Function for initializing the state machine in @ref CONN_STATE_IDLE.
+ *
+ * @param[in] p_init Actions. All must be set.
+ */
+void conn_sm_init(conn_sm_init_t const * p_init);
+
+/**@brief Function for passing an event to the state machine.
+ *
+ * @details May be called from the main loop and from interrupt handlers; transitions run in a
+ *          critical region.
+ */
+void conn_sm_evt_put(conn_sm_evt_t const * p_evt);
+
+/**@brief Function for getting the current state. */
+conn_state_t conn_sm_state_get(void);
+
+/**@brief Function for getting the name of a state. */
+char const * conn_sm_state_name(conn_state_t state);
+
+/**@brief Function for getting the time spent per state. */
+void conn_sm_stats_get(conn_sm_stats_t * p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CONN_SM_H__
@@ -40,8 +40,11 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "nrf_sdh.h"
 #include "nrf_sdh_ble.h"
+#include "nrf_sdh_soc.h"
+#include "nrf_section.h"
 #include "nrf_log.h"
 #include "nrf_log_ctrl.h"
 #include "nrf_log_default_backends.h"
@@ -49,37 +52,500 @@
 #include "ble_advdata.h"
 #include "app_timer.h"
 #include "nrf_gpio.h"
+#include "nrf_timer.h"
+#include "app_scheduler.h"
+#include "report_ring.h"
+#include "report_codec.h"
+#include "report_rtt.h"
+#include "conn_sm.h"
+#include "scan_ctrl.h"
+#include "uart_cmd.h"
 
 #define APP_BLE_CONN_CFG_TAG 1      /**< A tag identifying the SoftDevice BLE configuration. */
 #define SCAN_DURATION_WITELIST 5000 /**< Duration of the scanning in units of 10 milliseconds. */
+#ifndef SCAN_CONTINUOUS
+#define SCAN_CONTINUOUS 1           /**< 1: scan without timeout and roll the dedup window in software. 0: restart the scan every SCAN_DURATION_WITELIST. */
+#endif
+#if (SCAN_CONTINUOUS == 1)
+#define SCAN_TIMEOUT BLE_GAP_SCAN_TIMEOUT_UNLIMITED
+#else
+#define SCAN_TIMEOUT SCAN_DURATION_WITELIST
+#endif
+#ifndef SCAN_ADAPTIVE
+#define SCAN_ADAPTIVE 1             /**< Lower the scan duty cycle while no new devices appear, see scan_ctrl.h. */
+#endif
+#define SCAN_DUTY_LEVELS SCAN_CTRL_DUTY_LEVELS /**< Number of scan duty levels, see @ref m_scan_duty. */
+#define DEDUP_BUCKET_MS 10000       /**< Dedup window granularity with SCAN_CONTINUOUS. */
+#define DEDUP_BUCKETS 5             /**< Buckets per dedup window: a device is reported once per DEDUP_BUCKETS * DEDUP_BUCKET_MS, give or take a bucket. */
 #define DEV_NAME_LEN ((BLE_GAP_ADV_SET_DATA_SIZE_MAX + 1) - \
                       AD_DATA_OFFSET) /**< Determines the device name length. */
 
+#ifndef SCAN_DIRECT
+#define SCAN_DIRECT 0 /**< 1: handle advertising reports in @ref ble_evt_handler and drive the GAP scanner directly, without nrf_ble_scan. */
+#endif
+
+#if (SCAN_DIRECT == 0)
 NRF_BLE_SCAN_DEF(m_scan); /**< Scanning module instance. */
+#define SCAN_PATH_NAME "nrf_ble_scan"
+#else
+#define SCAN_PATH_NAME "direct"
+#endif
+
+#define SCAN_PHYS_1M 0    /**< Scan LE 1M only. */
+#define SCAN_PHYS_CODED 1 /**< Scan LE Coded only, for long range advertisers. */
+#define SCAN_PHYS_BOTH 2  /**< Scan LE 1M and LE Coded in turn, one window each per interval. */
+#ifndef SCAN_PHYS
+#define SCAN_PHYS SCAN_PHYS_1M /**< Primary PHYs scanned. */
+#endif
+#define SCAN_1M_INTERVAL NRF_BLE_SCAN_SCAN_INTERVAL          /**< Full duty scan interval with SCAN_PHYS_1M. */
+#define SCAN_1M_WINDOW NRF_BLE_SCAN_SCAN_WINDOW              /**< Full duty scan window with SCAN_PHYS_1M. */
+#define SCAN_CODED_INTERVAL MSEC_TO_UNITS(40, UNIT_0_625_MS) /**< Full duty scan interval with SCAN_PHYS_CODED. A Coded advertising packet takes up to 17 ms on air. */
+#define SCAN_CODED_WINDOW MSEC_TO_UNITS(40, UNIT_0_625_MS)   /**< Full duty scan window with SCAN_PHYS_CODED. */
+#define SCAN_BOTH_INTERVAL MSEC_TO_UNITS(80, UNIT_0_625_MS)  /**< Full duty scan interval with SCAN_PHYS_BOTH. At least twice the window. */
+#define SCAN_BOTH_WINDOW MSEC_TO_UNITS(40, UNIT_0_625_MS)    /**< Full duty scan window of each PHY with SCAN_PHYS_BOTH. */
+#if (SCAN_PHYS == SCAN_PHYS_BOTH)
+#define SCAN_PHY_COUNT 2                       /**< PHYs sharing each scan interval. */
+#define SCAN_GAP_PHYS (BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_CODED)
+#define SCAN_FULL_INTERVAL SCAN_BOTH_INTERVAL
+#define SCAN_FULL_WINDOW SCAN_BOTH_WINDOW
+#elif (SCAN_PHYS == SCAN_PHYS_CODED)
+#define SCAN_PHY_COUNT 1
+#define SCAN_GAP_PHYS BLE_GAP_PHY_CODED
+#define SCAN_FULL_INTERVAL SCAN_CODED_INTERVAL
+#define SCAN_FULL_WINDOW SCAN_CODED_WINDOW
+#else
+#define SCAN_PHY_COUNT 1
+#define SCAN_GAP_PHYS BLE_GAP_PHY_1MBPS
+#define SCAN_FULL_INTERVAL SCAN_1M_INTERVAL
+#define SCAN_FULL_WINDOW SCAN_1M_WINDOW
+#endif
+#ifndef SCAN_TARGET_FILTER
+#define SCAN_TARGET_FILTER 0        /**< 1: match TARGET_DEVICE_NAME with an nrf_ble_scan name filter that connects on match, instead of in software. */
+#endif
+#if (SCAN_TARGET_FILTER == 1) && (SCAN_DIRECT == 1)
+#error "SCAN_TARGET_FILTER requires nrf_ble_scan, SCAN_DIRECT 0."
+#endif
+
+#ifndef SCAN_WHITELIST
+#define SCAN_WHITELIST 0            /**< 1: once target devices are known, scan with a whitelist of them so the SoftDevice drops every other report. */
+#endif
+#if (SCAN_WHITELIST == 1) && (SCAN_TARGET_FILTER == 1)
+// With a whitelist active nrf_ble_scan connects on every whitelisted report, without a name match.
+#error "SCAN_WHITELIST cannot be combined with SCAN_TARGET_FILTER."
+#endif
+#define WHITELIST_SLICE_MS 2000     /**< Time a whitelist of up to BLE_GAP_WHITELIST_ADDR_MAX_COUNT targets is scanned before rotating to the next ones. */
+#define WHITELIST_LEARN_EVERY 8     /**< Every this many slices one slice accepts all devices, so new targets are still found. */
+
+#ifndef SCAN_ACTIVE_SELECTIVE
+#define SCAN_ACTIVE_SELECTIVE 0     /**< 1: scan passively, and actively only while a scannable device's scan response is missing or stale. */
+#endif
+#define SCAN_RSP_CHECK_MS 1000      /**< Interval of the selective active scanning check. */
+#define SCAN_RSP_STALE_S 60         /**< Age after which a scan response is requested again, in seconds. */
+#define SCAN_RSP_RETRY_S 5          /**< Time a scan response is requested for before backing off for SCAN_RSP_STALE_S, in seconds. */
 
-#define MAX_ADDRESS_COUNT 100
+#ifndef SCAN_WHILE_CONNECTED
+#define SCAN_WHILE_CONNECTED 1      /**< 1: keep scanning while connected, in the part of each connection interval the connection event leaves. */
+#endif
+#define SCAN_CONN_GUARD 2           /**< Radio time kept free between a scan window and the next connection event, in 0.625 ms units. */
+
+#ifndef RSSI_GATE
+#define RSSI_GATE 1                 /**< 1: drop reports below the RSSI floor of their device's class before any other work. */
+#endif
+#define RSSI_FLOOR_OTHER -85        /**< RSSI floor of devices not known as targets at startup, in dBm. Set with the "rssi" UART command. */
+#define RSSI_FLOOR_TARGET -100      /**< RSSI floor of target devices at startup, in dBm. */
+#define RSSI_HYSTERESIS 6           /**< Once a device reached its floor, its reports pass down to this much below it, in dB. */
+#define RSSI_HOLD_MS 5000           /**< Time without a report above the lowered floor after which a device needs its full floor again. */
+
+#ifndef SCAN_PROFILE_DEFAULT
+#define SCAN_PROFILE_DEFAULT SCAN_PROFILE_BALANCED /**< Scan profile at startup, see @ref m_scan_profiles. */
+#endif
+#define CONN_FAST_INTERVAL_MAX MSEC_TO_UNITS(15, UNIT_1_25_MS) /**< Maximum connection interval of the connect-pending profile. */
+
+#define MAX_ADDRESS_COUNT 255             /**< Size of the device address dictionary. Indexes must fit in one byte. */
+#define ADDRESS_DICT_RESYNC_REPORTS 500   /**< Number of reports after which all addresses are announced again. */
 #define APP_BLE_OBSERVER_PRIO 3
+#define TIMESTAMP_OBSERVER_PRIO 0      /**< Runs before every other BLE observer to stamp events at entry. */
+#define TIMESTAMP_TIMER NRF_TIMER1     /**< Free-running 1 MHz timer used for timestamps, except in profiles with rtc_timestamps. TIMER0 belongs to the SoftDevice. */
+
+#define REPORT_OUTPUT_TEXT 0   /**< Reports are logged as human-readable text. */
+#define REPORT_OUTPUT_BINARY 1 /**< Reports are logged as compact binary frames, see report_codec.h. */
+#define REPORT_OUTPUT_RTT 2    /**< Reports are written as binary frames to a dedicated RTT channel, see report_rtt.h. */
+#ifndef REPORT_OUTPUT_MODE
+#define REPORT_OUTPUT_MODE REPORT_OUTPUT_BINARY /**< Format of the device reports. */
+#endif
+
+#define REPORT_POLICY_DEDUP 0      /**< Report a device once per scan window. */
+#define REPORT_POLICY_RATE_LIMIT 1 /**< Report a device at most at the rate configured for its class. */
+#define REPORT_POLICY_ALL 2        /**< Report every advertising report. */
+#ifndef REPORT_POLICY
+#define REPORT_POLICY REPORT_POLICY_DEDUP /**< Which advertising reports are passed on. */
+#endif
+
+#ifndef REPORT_DEFERRED_PROCESSING
+#define REPORT_DEFERRED_PROCESSING 1 /**< Process reports in the main loop instead of the SoftDevice event handler. */
+#endif
+#define REPORT_DATA_MAX 255          /**< Advertising data bytes kept per queued report. */
+#define REPORT_RING_SIZE 32          /**< Number of report slots between the handler and the main loop. Power of two. */
+#ifndef REPORT_BATCH_MAX
+#define REPORT_BATCH_MAX 8           /**< Reports processed per main loop wakeup before the log is flushed. */
+#endif
+#ifndef REPORT_FAST_LANE
+#define REPORT_FAST_LANE 1           /**< Connect to target devices from the SoftDevice event handler and queue their reports ahead of the rest. */
+#endif
+#define REPORT_FAST_RING_SIZE 4      /**< Number of report slots of the fast lane. Power of two. */
+#define REPORT_CLASS_MAP_SIZE 256    /**< Buckets of the address to shedding class map. Power of two, at most 256. */
+#define REPORT_TRACKED_MIN 4         /**< Reports after which a known device counts as tracked. */
+#define REPORT_CLASS_AGE_MS 10000    /**< Interval at which report counts are halved and the class map is rebuilt. */
+#define REPORT_CLASS_HASH(p_addr) (((p_addr)[0] ^ (p_addr)[1]) & (REPORT_CLASS_MAP_SIZE - 1)) /**< Bucket of an address in the class map. */
+#ifndef REPORT_SCAN_BUFFER_POOL
+#define REPORT_SCAN_BUFFER_POOL REPORT_DEFERRED_PROCESSING /**< Scan into the data buffers of free report slots, so reports are queued without a copy. */
+#endif
+#if (REPORT_SCAN_BUFFER_POOL == 1) && (REPORT_DEFERRED_PROCESSING != 1)
+#error "REPORT_SCAN_BUFFER_POOL requires REPORT_DEFERRED_PROCESSING."
+#endif
+#if (REPORT_OUTPUT_MODE == REPORT_OUTPUT_RTT)
+#define REPORT_BATCH_BUFFER_SIZE 1024                    /**< Records written to RTT in one call. */
+#else
+#define REPORT_BATCH_BUFFER_SIZE REPORT_CODEC_RECORD_MAX /**< Records logged as one hex line. */
+#endif
+
+#define SCHED_MAX_EVENT_DATA_SIZE APP_TIMER_SCHED_EVENT_DATA_SIZE /**< Maximum size of scheduler events. */
+#define SCHED_QUEUE_SIZE 8                                        /**< Maximum number of events in the scheduler queue. */
+
+#define POLL_EVT_BUDGET 8 /**< SoftDevice events dispatched per main loop iteration when built with NRF_SDH_DISPATCH_MODEL_POLLING. */
+#define POLL_LOG_BUDGET 4 /**< Log entries processed per main loop iteration when built with NRF_SDH_DISPATCH_MODEL_POLLING. */
+
+#define STATS_INTERVAL_MS 10000                         /**< Interval between statistics log lines, in milliseconds. */
+#define STATS_INTERVAL APP_TIMER_TICKS(STATS_INTERVAL_MS) /**< Interval between statistics log lines. */
+#define ADV_CHANNEL_FIRST 37                   /**< Index of the first primary advertising channel. */
+#define ADV_CHANNEL_COUNT 3                    /**< Primary advertising channels, 37 to 39. */
+#define ADV_CHANNEL_RSSI_BUCKETS 4             /**< RSSI classes per channel: above -60, -75, -90 dBm and below. */
+#define ADV_CHANNEL_MIN_REPORTS 30             /**< Reports on the best channel needed before a channel is flagged. */
+#ifndef SCAN_CHANNEL_MASK
+#define SCAN_CHANNEL_MASK {0, 0, 0, 0, 0}      /**< Channels not to scan, as ble_gap_ch_mask_t: bits 5 to 7 of the last byte are channels 37 to 39. */
+#endif
+#define ADV_CHANNEL_LOSS_FLAG 250              /**< Report shortfall against the best channel, in 1/1000, that flags a channel as interfered. */
+#define CPU_CYCLES_PER_US 64                  /**< CPU clock in MHz, for converting cycle counts. */
 
 #define CONN_INTERVAL_MIN MSEC_TO_UNITS(7.5, UNIT_1_25_MS) /**< Minimum acceptable connection interval, in 1.25 ms units. */
 #define CONN_INTERVAL_MAX MSEC_TO_UNITS(500, UNIT_1_25_MS) /**< Maximum acceptable connection interval, in 1.25 ms units. */
 #define CONN_SUP_TIMEOUT MSEC_TO_UNITS(4000, UNIT_10_MS)   /**< Connection supervisory timeout (4 seconds). */
 #define SLAVE_LATENCY 0                                    /**< Slave latency. */
 
-uint8_t address_list[MAX_ADDRESS_COUNT][BLE_GAP_ADDR_LEN] = {0};
+#define TARGET_DEVICE_NAME "AW050 DefaultSerialNumber!" /**< Local name of the device to connect to. */ // DeviceToTest
+
+/**@brief Entry of the device address dictionary.
+ *
+ * @details The position of an entry in @ref address_list is the short index a device is reported
+ *          with. The full address is only sent the first time a device is reported after a
+ *          dictionary resync; later reports carry the index alone.
+ */
+typedef struct
+{
+    uint8_t addr[BLE_GAP_ADDR_LEN]; /**< Device address. */
+    bool announced;                 /**< Full address sent since the last dictionary resync. */
+    uint16_t seen_bucket;           /**< Dedup bucket the device was last reported in, see @ref m_dedup_bucket. */
+    uint8_t device_class;           /**< Class of the device, see @ref device_class_t. */
+    uint8_t addr_type;              /**< Address type, set once the device is a target. */
+    uint32_t rate_tat;              /**< Rate limiter: earliest time the bucket is full again, in microseconds. */
+    uint8_t reports;                /**< Reports processed, saturating. Halved every REPORT_CLASS_AGE_MS with REPORT_DEFERRED_PROCESSING. */
+    uint8_t scan_rsp;               /**< Scan response state, see @ref scan_rsp_state_t. With SCAN_ACTIVE_SELECTIVE. */
+    uint16_t rsp_tick;              /**< Tick the scan response state last changed, see @ref m_scan_rsp_tick. */
+    uint16_t seen_tick;             /**< Tick of the last report, see @ref m_scan_rsp_tick. */
+    bool rssi_admitted;             /**< Reached its RSSI floor, the floor is lowered by RSSI_HYSTERESIS. With RSSI_GATE. */
+    uint32_t rssi_ts;               /**< Time of the last report above the device's floor, in microseconds. */
+    uint32_t report_seq;            /**< @ref m_report_seq at the device's last report, for eviction. */
+} address_entry_t;
+
+/**@brief Scan response state of a device, for selective active scanning. */
+typedef enum
+{
+    SCAN_RSP_NONE,     /**< Not scannable. */
+    SCAN_RSP_MISSING,  /**< Scannable, scan response wanted. */
+    SCAN_RSP_RECEIVED, /**< Scan response received, or given up on, recently. */
+} scan_rsp_state_t;
+
+/**@brief Device classes with their own reporting rate. */
+typedef enum
+{
+    DEVICE_CLASS_OTHER,  /**< Any device. */
+    DEVICE_CLASS_TARGET, /**< Device that matched the connect criteria. */
+    DEVICE_CLASS_COUNT
+} device_class_t;
+
+/**@brief Classes of reports under overload, in the order they are shed: unknown first. */
+typedef enum
+{
+    REPORT_CLASS_UNKNOWN, /**< Device not in the dictionary. */
+    REPORT_CLASS_KNOWN,   /**< Device in the dictionary. */
+    REPORT_CLASS_TRACKED, /**< Device reported at least @ref REPORT_TRACKED_MIN times. */
+    REPORT_CLASS_TARGET,  /**< Device that matched the connect criteria. Never shed. */
+    REPORT_CLASS_COUNT
+} report_class_t;
+
+/**@brief Reports received and shed per class. */
+typedef struct
+{
+    uint32_t reports; /**< Reports received. */
+    uint32_t shed;    /**< Reports dropped at entry because the ring was over the class quota. */
+} class_stats_t;
+
+/**@brief Token bucket configuration of a device class. */
+typedef struct
+{
+    uint32_t interval_us; /**< Time to earn one report, in microseconds. */
+    uint8_t burst;        /**< Bucket size: reports that may be sent back to back. */
+} rate_limit_t;
+
+#if (REPORT_POLICY == REPORT_POLICY_RATE_LIMIT)
+/**@brief Reporting rate per device class. */
+static rate_limit_t const m_rate_limits[DEVICE_CLASS_COUNT] =
+    {
+        [DEVICE_CLASS_OTHER] = {.interval_us = 1000000 / 1, .burst = 1},
+        [DEVICE_CLASS_TARGET] = {.interval_us = 1000000 / 10, .burst = 3},
+};
+#endif
+
+address_entry_t address_list[MAX_ADDRESS_COUNT] = {0};
 int address_list_length = 0;
+int reports_since_resync = 0;
+
+/**@brief Advertising report captured in the SoftDevice event handler for the main loop. */
+typedef struct
+{
+    uint32_t timestamp;                  /**< Timestamp of the report's BLE event. */
+    ble_gap_evt_adv_report_t adv_report; /**< Report. data.p_data must be pointed at data after copying. */
+    uint8_t data[REPORT_DATA_MAX];       /**< Advertising data. */
+} scan_report_t;
+
+/**@brief Path a connect to a target device was initiated from. */
+typedef enum
+{
+    CONNECT_LANE_FAST, /**< SoftDevice event handler, ahead of all queued reports. */
+    CONNECT_LANE_BULK, /**< Regular report processing. */
+    CONNECT_LANE_FILTER, /**< nrf_ble_scan name filter, connecting before the application sees the report. */
+    CONNECT_LANE_COUNT
+} connect_lane_t;
+
+/**@brief Time from a target device's report to the connect call and to the connection, per lane. */
+typedef struct
+{
+    uint32_t count;              /**< Connect calls. */
+    uint32_t latency_total_us;   /**< Sum of report to connect call times, in microseconds. */
+    uint32_t latency_max_us;     /**< Longest report to connect call time, in microseconds. */
+    uint32_t connected;          /**< Connections established. */
+    uint32_t connected_total_us; /**< Sum of report to connection times, in microseconds. */
+    uint32_t connected_max_us;   /**< Longest report to connection time, in microseconds. */
+    uint32_t duty_total;         /**< Sum of the initiator scan duties of the connect calls, in permille. */
+} connect_stats_t;
+
+/**@brief Time spent handling reports in interrupt context, counted from the BLE event's entry
+ *        into the observer chain so the scanner module's own overhead is included. */
+typedef struct
+{
+    uint32_t count;        /**< Reports handled. */
+    uint32_t coded;        /**< Part of count received on the LE Coded PHY. */
+    uint32_t cycles_total; /**< CPU cycles spent in the handler. */
+    uint32_t cycles_max;   /**< Longest report handling, in CPU cycles. */
+    uint32_t pause_us;     /**< Time the scan was paused between a report and resuming, in microseconds. */
+    uint32_t waits;        /**< Reports after which no free scan buffer was left. */
+    uint32_t wait_us;      /**< Part of pause_us spent in those reports. */
+    uint32_t connected;    /**< Part of count received while connected. */
+} handler_stats_t;
+
+#if (SCAN_WHILE_CONNECTED == 1)
+/**@brief Scanning while connected. */
+typedef struct
+{
+    bool active;       /**< Scanning between the connection events of the link. */
+    uint16_t interval; /**< Scan interval, the connection interval, in 0.625 ms units. */
+    uint16_t window;   /**< Radio time per interval for all PHYs scanned, in 0.625 ms units. */
+    uint32_t start_ts; /**< Start of the time not yet added to scan_us. */
+    uint32_t scan_us;  /**< Time connected with the scan running since the last log line. */
+    uint32_t lost_us;  /**< Part of scan_us left to the connection events. */
+    uint32_t starts;   /**< Scan starts on a new connection interval since the last log line. */
+    uint32_t skipped;  /**< Connection intervals too short to scan in since the last log line. */
+} conn_scan_t;
+#endif
+
+/**@brief Reception on one primary advertising channel since the last log line.
+ *
+ * @details The scanner listens on the three channels in turn for the same time, and advertisers
+ *          send every advertisement on all three, so the channels should see the same number
+ *          of reports. Packets that fail the CRC are never reported; the shortfall of a channel
+ *          against the best one estimates its loss. Scan responses lost to the same
+ *          interference show up as a lower scan response share.
+ */
+typedef struct
+{
+    uint16_t reports;                        /**< Reports, saturating. */
+    uint16_t scannable;                      /**< Scannable advertisements, each followed by a scan request. */
+    uint16_t scan_rsp;                       /**< Scan responses. */
+    uint16_t rssi[ADV_CHANNEL_RSSI_BUCKETS]; /**< Reports per RSSI class. */
+} channel_stats_t;
+
+/**@brief SoftDevice event polling in the main loop. */
+typedef struct
+{
+    uint32_t iterations; /**< Main loop iterations. */
+    uint32_t events;     /**< SoftDevice events dispatched. */
+    uint32_t saturated;  /**< Iterations that used the whole @ref POLL_EVT_BUDGET. */
+} poll_stats_t;
+
+/**@brief Scan timing of one duty level, in units of 0.625 ms. */
+typedef struct
+{
+    uint16_t interval;
+    uint16_t window;
+} scan_duty_t;
+
+/**@brief Scan profiles, see @ref m_scan_profiles. */
+typedef enum
+{
+    SCAN_PROFILE_FAST_DISCOVERY,
+    SCAN_PROFILE_BALANCED,
+    SCAN_PROFILE_LOW_POWER,
+    SCAN_PROFILE_CONNECT_PENDING,
+    SCAN_PROFILE_COUNT
+} scan_profile_id_t;
+
+/**@brief Scan and connection parameters selectable at runtime. */
+typedef struct
+{
+    char const *p_name;                         /**< Name used by the profile command. */
+    uint8_t active;                             /**< 1: send scan requests, 0: passive scanning. */
+    uint8_t scan_phys;                          /**< Primary PHYs, BLE_GAP_PHY_1MBPS and/or BLE_GAP_PHY_CODED. */
+    scan_duty_t duty;                           /**< Full duty interval and window. With both PHYs the interval must be at least twice the window. */
+    bool adaptive;                              /**< Let the duty controller lower the duty, with SCAN_ADAPTIVE. */
+    bool rtc_timestamps;                        /**< Count timestamps on the app_timer RTC, at its resolution, and stop TIMESTAMP_TIMER so it does not keep the high frequency clock requested. */
+    ble_gap_conn_params_t const *p_conn_param;  /**< Parameters of connections made under this profile. */
+} scan_profile_t;
+
+/**@brief Scan profile switches. */
+typedef struct
+{
+    uint32_t switches;       /**< Profile switches. */
+    uint32_t restarts;       /**< Parameter changes that restarted a running scan. */
+    uint32_t restart_us_max; /**< Longest stop to start of those restarts. */
+} scan_profile_stats_t;
+
+#if (SCAN_CONTINUOUS == 0)
+/**@brief Radio gaps of restarting the scan after each timeout. */
+typedef struct
+{
+    uint32_t window_start_ts; /**< Start of the current scan window. */
+    uint32_t window_reports;  /**< Reports received in the current scan window. */
+    uint32_t timeout_ts;      /**< Time the last scan window timed out. */
+    bool pending;             /**< Timed out, not restarted yet. */
+    uint32_t restarts;        /**< Restarts after a timeout. */
+    uint32_t gap_us;          /**< Time the radio was off between timeouts and restarts. */
+    uint32_t lost_reports;    /**< Reports estimated lost in the gaps. */
+} scan_gap_stats_t;
+#endif
+
+APP_TIMER_DEF(m_stats_timer_id);        /**< Statistics log timer. */
+#if (SCAN_ADAPTIVE == 1)
+APP_TIMER_DEF(m_scan_ctrl_timer_id);    /**< Scan duty controller tick timer. */
+static scan_ctrl_t m_scan_ctrl;         /**< Scan duty controller. */
+static volatile uint32_t m_scan_ctrl_reports;     /**< Reports since the last controller tick. */
+static volatile uint32_t m_scan_ctrl_new_devices; /**< Devices added to the dictionary since the last controller tick. */
+static uint32_t m_scan_ctrl_level_ticks[SCAN_DUTY_LEVELS]; /**< Controller ticks per level since the last log line. */
+#endif
+static handler_stats_t m_handler_stats; /**< Scan event handler statistics since the last log line. */
+static channel_stats_t m_channel_stats[ADV_CHANNEL_COUNT]; /**< Reception per primary advertising channel since the last log line. */
+static volatile uint16_t m_dedup_bucket; /**< Current dedup bucket. Advanced by a timer with SCAN_CONTINUOUS, by a whole window on every scan start otherwise. */
+#if (SCAN_CONTINUOUS == 1)
+APP_TIMER_DEF(m_dedup_timer_id);        /**< Dedup bucket timer. */
+#else
+static scan_gap_stats_t m_scan_gap;     /**< Scan restart gaps. */
+#endif
+
+#if (REPORT_DEFERRED_PROCESSING == 1)
+REPORT_RING_DEF(m_report_ring, REPORT_RING_SIZE);       /**< Handoff from the scan event handler to the main loop. */
+static scan_report_t m_report_slots[REPORT_RING_SIZE]; /**< Slots of @ref m_report_ring. */
+static uint32_t m_batch_histogram[REPORT_BATCH_MAX + 1]; /**< Main loop wakeups by number of reports processed. */
+#if (REPORT_FAST_LANE == 1)
+REPORT_RING_DEF(m_fast_ring, REPORT_FAST_RING_SIZE);        /**< Reports of target devices, processed before @ref m_report_ring. */
+static scan_report_t m_fast_slots[REPORT_FAST_RING_SIZE]; /**< Slots of @ref m_fast_ring. */
+#endif
+/**@brief Ring fill level up to which a report of each class is queued. */
+static uint16_t const m_class_quota[REPORT_CLASS_COUNT] =
+    {
+        [REPORT_CLASS_UNKNOWN] = REPORT_RING_SIZE / 2,
+        [REPORT_CLASS_KNOWN] = REPORT_RING_SIZE * 3 / 4,
+        [REPORT_CLASS_TRACKED] = REPORT_RING_SIZE * 7 / 8,
+        [REPORT_CLASS_TARGET] = REPORT_RING_SIZE,
+};
+static uint8_t m_class_map[REPORT_CLASS_MAP_SIZE];     /**< Shedding class per address bucket, written by the main loop. Colliding devices share the higher class. */
+APP_TIMER_DEF(m_class_timer_id);                        /**< Class map aging timer. */
+static class_stats_t m_class_stats[REPORT_CLASS_COUNT]; /**< Reports per class since the last log line. */
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+static ble_data_t m_scan_buffer; /**< Data buffer of the next free report slot while the SoftDevice owns it, p_data is NULL otherwise. */
+#endif
+#endif
+static connect_stats_t m_connect_stats[CONNECT_LANE_COUNT]; /**< Connect latency per lane. */
+
+#if (SCAN_DIRECT == 1)
+static uint8_t m_scan_data[REPORT_DATA_MAX];                                               /**< Scan buffer used when no report slot is handed out. */
+static ble_data_t const m_scan_data_buffer = {.p_data = m_scan_data, .len = sizeof(m_scan_data)}; /**< Descriptor of @ref m_scan_data. */
+static volatile bool m_scan_stopped;                                                       /**< Scan stopped by the application, do not resume. */
+#endif
+
+static uint32_t m_evt_timestamp;        /**< Timestamp of the BLE event being dispatched. */
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+static volatile uint32_t m_evt_signal_ts;  /**< Time the oldest SoftDevice event not yet fetched was signalled. */
+static volatile bool m_evt_signalled;      /**< @ref m_evt_signal_ts is set. */
+static uint32_t m_evt_poll_ts;             /**< Arrival time given to the events fetched in this main loop iteration. */
+#endif
+static volatile bool m_scan_timeout_missed;      /**< A scan timeout found the scheduler queue full, the main loop handles it. */
+static volatile uint32_t m_scan_timeout_missed_ts; /**< Timestamp of the missed scan timeout. */
+static uint32_t m_evt_cycles;           /**< Cycle counter at the BLE event's entry into the observer chain. */
+static uint32_t m_connect_report_ts;    /**< Timestamp of the report that triggered the last connect. */
+static uint32_t m_connect_call_ts;      /**< Timestamp of the last sd_ble_gap_connect() call. */
+static connect_lane_t m_connect_lane;   /**< Lane of the last connect. */
+#if (SCAN_TARGET_FILTER == 1)
+static ret_code_t m_filter_connect_err; /**< Result of nrf_ble_scan's connect call on the last filter match. */
+static uint16_t m_filter_connect_duty;  /**< Initiator scan duty of nrf_ble_scan's connect call on the last filter match, in permille. */
+#endif
+static uint32_t m_target_report_ts;     /**< Timestamp of the last target report passed to the state machine. */
+static connect_lane_t m_target_lane;    /**< Lane of the last target report passed to the state machine. */
+static uint16_t m_discovered_services;  /**< Primary services found by the running discovery. */
+
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+static report_codec_t m_report_codec;                   /**< Delta state of the binary report stream. */
+static uint8_t m_batch_buffer[REPORT_BATCH_BUFFER_SIZE]; /**< Records waiting to be written as one batch. */
+static uint16_t m_batch_len;                            /**< Bytes in @ref m_batch_buffer. */
+static uint16_t m_batch_frames;                         /**< Records in @ref m_batch_buffer. */
+#if (REPORT_OUTPUT_MODE == REPORT_OUTPUT_BINARY)
+static uint8_t m_batch_seq;                             /**< Sequence number of the next '@' line, a gap tells the host a line was lost. */
+#endif
+#endif
 
-/**< Scan parameters requested for scanning and connection. */
-static ble_gap_scan_params_t const m_scan_param =
+/**@brief Scan interval and radio time per interval of the reduced duty levels, from level 1.
+ *        Level 0 is the full duty of the scan profile. The radio time is split between the PHYs
+ *        scanned. The table lives in scan_ctrl.h so the host replay runs the same levels.
+ */
+static scan_duty_t const m_scan_duty[SCAN_DUTY_LEVELS - 1] = SCAN_CTRL_REDUCED_DUTY;
+
+/**< Scan parameters requested for scanning and connection. Set from the scan profile and the duty level. */
+static ble_gap_scan_params_t m_scan_param =
     {
+#if (SCAN_PHYS != SCAN_PHYS_1M)
+        .extended = 1, // Coded PHY advertising uses extended advertising PDUs.
+#endif
         .active = 0x01,
-        .interval = NRF_BLE_SCAN_SCAN_INTERVAL,
-        .window = NRF_BLE_SCAN_SCAN_WINDOW,
+        .interval = SCAN_FULL_INTERVAL,
+        .window = SCAN_FULL_WINDOW,
         .filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL, // BLE_GAP_SCAN_FP_WHITELIST,
-        .timeout = SCAN_DURATION_WITELIST,
-        .scan_phys = BLE_GAP_PHY_1MBPS,
+        .timeout = SCAN_TIMEOUT,
+        .scan_phys = SCAN_GAP_PHYS,
+        .channel_mask = SCAN_CHANNEL_MASK,
 };
+#if (SCAN_PHYS == SCAN_PHYS_BOTH)
+STATIC_ASSERT(SCAN_BOTH_INTERVAL >= 2 * SCAN_BOTH_WINDOW); // The SoftDevice scans the PHYs one window after the other.
+#endif
 
-static ble_gap_conn_params_t m_conn_param =
+static ble_gap_conn_params_t const m_conn_param =
     {
         .min_conn_interval = (uint16_t)CONN_INTERVAL_MIN, // Minimum connection interval.
         .max_conn_interval = (uint16_t)CONN_INTERVAL_MAX, // Maximum connection interval.
@@ -87,41 +553,428 @@ static ble_gap_conn_params_t m_conn_param =
         .conn_sup_timeout = (uint16_t)CONN_SUP_TIMEOUT    // Supervisory timeout.
 };
 
-bool address_list_contains(const uint8_t address[])
+/**@brief Connection parameters of the connect-pending profile: a short interval so discovery
+ *        right after the connection completes quickly.
+ */
+static ble_gap_conn_params_t const m_conn_param_fast =
+    {
+        .min_conn_interval = (uint16_t)CONN_INTERVAL_MIN,
+        .max_conn_interval = (uint16_t)CONN_FAST_INTERVAL_MAX,
+        .slave_latency = (uint16_t)SLAVE_LATENCY,
+        .conn_sup_timeout = (uint16_t)CONN_SUP_TIMEOUT,
+};
+
+/**@brief Scan profiles, selected with @ref scan_profile_set or the "profile <name>" UART command.
+ */
+static scan_profile_t const m_scan_profiles[SCAN_PROFILE_COUNT] =
+    {
+        [SCAN_PROFILE_FAST_DISCOVERY] = {
+            .p_name = "fast-discovery",
+            .active = 1,
+            .scan_phys = SCAN_GAP_PHYS,
+            .duty = {SCAN_FULL_INTERVAL, SCAN_FULL_WINDOW},
+            .adaptive = false,
+            .rtc_timestamps = false,
+            .p_conn_param = &m_conn_param,
+        },
+        [SCAN_PROFILE_BALANCED] = {
+            .p_name = "balanced",
+            .active = 1,
+            .scan_phys = SCAN_GAP_PHYS,
+            .duty = {SCAN_FULL_INTERVAL, SCAN_FULL_WINDOW},
+            .adaptive = true,
+            .rtc_timestamps = false,
+            .p_conn_param = &m_conn_param,
+        },
+        [SCAN_PROFILE_LOW_POWER] = {
+            .p_name = "low-power",
+            .active = 0,
+            .scan_phys = SCAN_GAP_PHYS,
+            .duty = {MSEC_TO_UNITS(1000, UNIT_0_625_MS), MSEC_TO_UNITS(30, UNIT_0_625_MS) / SCAN_PHY_COUNT},
+            .adaptive = false,
+            .rtc_timestamps = true,
+            .p_conn_param = &m_conn_param,
+        },
+        [SCAN_PROFILE_CONNECT_PENDING] = {
+            .p_name = "connect-pending",
+            .active = 0, // No scan requests: the radio keeps listening for the target.
+            .scan_phys = SCAN_GAP_PHYS,
+            .duty = {SCAN_FULL_INTERVAL, SCAN_FULL_WINDOW},
+            .adaptive = false,
+            .rtc_timestamps = false,
+            .p_conn_param = &m_conn_param_fast,
+        },
+};
+static scan_profile_t const *m_scan_profile = &m_scan_profiles[SCAN_PROFILE_DEFAULT]; /**< Current scan profile. */
+static scan_profile_stats_t m_scan_profile_stats;                                        /**< Scan profile switches since the last log line. */
+static uint8_t m_scan_level;                                                             /**< Duty level of @ref m_scan_param. */
+static uint32_t m_wakeups;                                                               /**< Main loop wakeups from sleep since the last log line. */
+static uint32_t m_discovered;                                                            /**< Devices added to the dictionary since the last log line. */
+static uint32_t m_evicted;                                                               /**< Devices evicted from the full dictionary since the last log line. */
+static uint32_t m_report_seq;                                                            /**< Reports processed, orders dictionary entries by last use. */
+#if (SCAN_WHILE_CONNECTED == 1)
+static conn_scan_t m_conn_scan;                                                          /**< Scanning while connected. */
+#endif
+#if (RSSI_GATE == 1)
+APP_TIMER_DEF(m_rssi_timer_id);                                      /**< RSSI hysteresis hold timer. */
+static int8_t m_rssi_floor[DEVICE_CLASS_COUNT] =
+    {
+        [DEVICE_CLASS_OTHER] = RSSI_FLOOR_OTHER,
+        [DEVICE_CLASS_TARGET] = RSSI_FLOOR_TARGET,
+};                                                                   /**< RSSI floor per device class, in dBm. */
+static int8_t m_rssi_floor_map[REPORT_CLASS_MAP_SIZE];               /**< Floor per address bucket, written by the main loop. Colliding devices share the lower floor. */
+static volatile uint32_t m_rssi_rejected;                            /**< Reports below the floor since the last log line. */
+static uint16_t m_rssi_admitted;                                     /**< Devices with the lowered floor. */
+#endif
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+APP_TIMER_DEF(m_scan_rsp_timer_id);  /**< Selective active scanning check timer. */
+static uint16_t m_scan_rsp_tick;     /**< Seconds, advanced by the check. */
+static bool m_scan_rsp_wanted;       /**< A scan response is wanted: scan actively. */
+static uint32_t m_scan_rsp_active_s; /**< Seconds scanned actively since the last log line. */
+#endif
+
+#if (SCAN_WHITELIST == 1)
+APP_TIMER_DEF(m_whitelist_timer_id);                                        /**< Whitelist rotation timer. */
+static ble_gap_addr_t m_whitelist_addrs[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];        /**< Targets of the current whitelist slice. */
+static ble_gap_addr_t const *m_whitelist_ptrs[BLE_GAP_WHITELIST_ADDR_MAX_COUNT]; /**< Pointers to @ref m_whitelist_addrs, as the SoftDevice takes them. */
+static uint8_t m_whitelist_len;                                                   /**< Targets in the current whitelist slice. */
+static uint8_t m_whitelist_cursor;                                                /**< Dictionary index the next slice starts looking for targets at. */
+static uint32_t m_whitelist_slices;                                               /**< Slices scanned, learning slices included. */
+static uint32_t m_whitelist_learning;                                             /**< Learning slices since the last log line. */
+static uint32_t m_whitelist_filtered;                                             /**< Whitelist slices since the last log line. */
+#endif
+
+static volatile bool m_ts_rtc;      /**< Timestamps are counted on the app_timer RTC, see @ref scan_profile_t::rtc_timestamps. */
+static uint32_t m_ts_offset;        /**< Timestamp at the last source switch, added to the source's count. */
+static uint32_t m_ts_rtc_ticks;     /**< RTC counter at the last RTC timestamp. */
+static uint64_t m_ts_rtc_total;     /**< RTC ticks since the switch to the RTC. */
+
+/**@brief Function for starting the free-running microsecond timestamp timer.
+ */
+static void timestamp_init(void)
 {
-    for (int i = 0; i < address_list_length; i++)
+    nrf_timer_mode_set(TIMESTAMP_TIMER, NRF_TIMER_MODE_TIMER);
+    nrf_timer_bit_width_set(TIMESTAMP_TIMER, NRF_TIMER_BIT_WIDTH_32);
+    nrf_timer_frequency_set(TIMESTAMP_TIMER, NRF_TIMER_FREQ_1MHz);
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_CLEAR);
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_START);
+}
+
+/**@brief Function for getting the current timestamp in microseconds from the app_timer RTC.
+ *
+ * @details The 24-bit RTC counter is extended with the ticks since the previous call, so it must
+ *          be read at least once per counter period (1024 s at 16384 Hz); the statistics timer
+ *          does. The result has the RTC's resolution, 61 us.
+ */
+static uint32_t timestamp_rtc_get(void)
+{
+    uint32_t timestamp;
+
+    CRITICAL_REGION_ENTER();
+    uint32_t ticks = app_timer_cnt_get();
+    m_ts_rtc_total += app_timer_cnt_diff_compute(ticks, m_ts_rtc_ticks);
+    m_ts_rtc_ticks = ticks;
+    timestamp = m_ts_offset + (uint32_t)((m_ts_rtc_total * 1000000ULL) / APP_TIMER_CLOCK_FREQ);
+    CRITICAL_REGION_EXIT();
+
+    return timestamp;
+}
+
+/**@brief Function for getting the current timestamp in microseconds.
+ *
+ * @details The TIMER counter cannot be read directly, so it is captured into CC[0] and read
+ *          back: one task write and one register read. The value wraps after about 71 minutes.
+ *          If a higher priority context captures in between, the later of the two values is
+ *          returned.
+ */
+static __INLINE uint32_t timestamp_get(void)
+{
+    if (m_ts_rtc)
+    {
+        return timestamp_rtc_get();
+    }
+    nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_CAPTURE0);
+    return m_ts_offset + nrf_timer_cc_read(TIMESTAMP_TIMER, NRF_TIMER_CC_CHANNEL0);
+}
+
+/**@brief Function for switching the timestamps between TIMESTAMP_TIMER and the app_timer RTC.
+ *
+ * @details The timestamps carry on from their value at the switch, so differences across it stay
+ *          valid. TIMESTAMP_TIMER is stopped while the RTC is used.
+ */
+static void timestamp_source_set(bool rtc)
+{
+    CRITICAL_REGION_ENTER();
+    if (rtc != m_ts_rtc)
     {
-        if (address_list[i][0] == address[0] && address_list[i][1] == address[1] && address_list[i][2] == address[2] && address_list[i][3] == address[3] && address_list[i][4] == address[4] && address_list[i][5] == address[5])
+        uint32_t now = timestamp_get();
+
+        if (rtc)
+        {
+            m_ts_rtc_ticks = app_timer_cnt_get();
+            m_ts_rtc_total = 0;
+            nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_STOP);
+        }
+        else
         {
+            nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_CLEAR);
+            nrf_timer_task_trigger(TIMESTAMP_TIMER, NRF_TIMER_TASK_START);
+        }
+        m_ts_offset = now;
+        m_ts_rtc = rtc;
+    }
+    CRITICAL_REGION_EXIT();
+}
 
-            return true;
+int address_list_find(const uint8_t address[])
+{
+    for (int i = 0; i < address_list_length; i++)
+    {
+        if (memcmp(address_list[i].addr, address, BLE_GAP_ADDR_LEN) == 0)
+        {
+            return i;
         }
     }
 
-    return false;
+    return -1;
+}
+
+/**@brief Function for finding the dictionary entry to reuse for a new device.
+ *
+ * @details The least recently reported device is evicted, targets only if every entry is one.
+ */
+static int address_list_evict(void)
+{
+    int lru = -1;
+    int lru_target = -1;
+
+    for (int i = 0; i < address_list_length; i++)
+    {
+        int *p_lru = (address_list[i].device_class == DEVICE_CLASS_TARGET) ? &lru_target : &lru;
+
+        if ((*p_lru < 0) ||
+            ((uint32_t)(m_report_seq - address_list[i].report_seq) >
+             (uint32_t)(m_report_seq - address_list[*p_lru].report_seq)))
+        {
+            *p_lru = i;
+        }
+    }
+    return (lru >= 0) ? lru : lru_target;
 }
 
-void address_list_add(const uint8_t address[])
+/**@brief Function for adding a device to the dictionary.
+ *
+ * @details A full dictionary makes room by evicting the least recently reported device. Its
+ *          index is reused: the entry starts over unannounced, so the next report of the new
+ *          device is a DEV frame that remaps the index on the host.
+ *
+ * @return Index of the device, or -1 if there is no room.
+ */
+int address_list_add(const uint8_t address[])
 {
-    if (address_list_length < MAX_ADDRESS_COUNT)
+    int index = address_list_length;
+
+    if (address_list_length == MAX_ADDRESS_COUNT)
+    {
+        index = address_list_evict();
+        if (index < 0)
+        {
+            return -1;
+        }
+        m_evicted++;
+    }
+    else
     {
-        memcpy(address_list[address_list_length], address, BLE_GAP_ADDR_LEN);
         address_list_length++;
     }
+
+    address_entry_t *p_entry = &address_list[index];
+
+    memset(p_entry, 0, sizeof(*p_entry));
+    memcpy(p_entry->addr, address, BLE_GAP_ADDR_LEN);
+    p_entry->announced = false;
+    p_entry->seen_bucket = m_dedup_bucket - DEDUP_BUCKETS;
+    p_entry->device_class = DEVICE_CLASS_OTHER;
+    p_entry->scan_rsp = SCAN_RSP_NONE;
+    p_entry->report_seq = m_report_seq;
+    m_discovered++;
+#if (SCAN_ADAPTIVE == 1)
+    m_scan_ctrl_new_devices++;
+#endif
+    return index;
+}
+
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+void address_list_resync(void);
+
+/**@brief Function for writing the batched records to the report stream.
+ *
+ * @details In @ref REPORT_OUTPUT_RTT mode the batch goes to its own RTT channel in one write.
+ *          Otherwise it is logged as one raw line made of '@', a sequence number and ':' in hex,
+ *          then the records in hex, so it can share the UART with the human-readable log.
+ *          tools/report_decode.c decodes both forms.
+ *
+ *          A batch that does not get out is not retried: the stream starts over with a dictionary
+ *          resync. A line lost later on, overwritten in the log buffer, only shows as a gap in the
+ *          sequence numbers, and the host decoder waits for the next resync.
+ */
+static void report_batch_flush(void)
+{
+    if (m_batch_len == 0)
+    {
+        return;
+    }
+
+#if (REPORT_OUTPUT_MODE == REPORT_OUTPUT_RTT)
+    if (!report_rtt_write(m_batch_buffer, m_batch_len, m_batch_frames))
+    {
+        // The deltas of later frames, and the host's dictionary, count on the dropped frames.
+        // Start over with a SYNC frame and announce every device again.
+        m_batch_len = 0;
+        m_batch_frames = 0;
+        address_list_resync();
+        return;
+    }
+#else
+    char hex_string[2 * REPORT_BATCH_BUFFER_SIZE + 4];
+    char const *p_line;
+    int len = sprintf(hex_string, "%02x:", m_batch_seq++);
+
+    for (uint16_t i = 0; i < m_batch_len; i++)
+    {
+        len += sprintf(&hex_string[len], "%02x", m_batch_buffer[i]);
+    }
+
+    // The push buffer is shared with every other pushed string until the log is processed; a
+    // line that does not fit is lost or cut short. The skipped sequence number tells the host.
+    p_line = nrf_log_push(hex_string);
+    if ((p_line == NULL) || (strlen(p_line) != (size_t)len))
+    {
+        m_batch_len = 0;
+        m_batch_frames = 0;
+        address_list_resync();
+        return;
+    }
+    NRF_LOG_RAW_INFO("@%s\r\n", p_line);
+#endif
+
+    m_batch_len = 0;
+    m_batch_frames = 0;
+}
+
+/**@brief Function for adding one encoded frame to the current batch.
+ */
+static void report_frame_write(uint8_t const *p_frame, uint16_t len)
+{
+    if (m_batch_len + REPORT_CODEC_RECORD_MAX - REPORT_CODEC_FRAME_MAX + len > sizeof(m_batch_buffer))
+    {
+        report_batch_flush();
+    }
+
+    m_batch_len += report_record_put(&m_batch_buffer[m_batch_len], p_frame, len);
+    m_batch_frames++;
+}
+
+/**@brief Function for sending a SYNC frame, giving a host the absolute time base of the stream.
+ */
+static void report_sync_output(void)
+{
+    uint8_t frame[REPORT_CODEC_FRAME_MAX];
+
+    report_frame_write(frame, report_encode_sync(&m_report_codec, timestamp_get(), frame));
+}
+
+/**@brief Function for sending a report in binary form.
+ *
+ * @details The first report of a device after a dictionary resync is sent as a DEV frame with
+ *          the full address and advertising data, later reports as RPT frames carrying only
+ *          the index and the RSSI and timestamp deltas.
+ */
+static void report_output(int index, const ble_gap_evt_adv_report_t *p_adv_report, uint32_t timestamp)
+{
+    uint8_t frame[REPORT_CODEC_FRAME_MAX];
+    uint16_t len;
+    report_rec_t rec =
+        {
+            .ts = timestamp,
+            .index = (index < 0) ? REPORT_CODEC_INDEX_NONE : (uint8_t)index,
+            .addr_type = p_adv_report->peer_addr.addr_type,
+            .rssi = p_adv_report->rssi,
+            .phy = p_adv_report->primary_phy,
+            .data_len = (uint8_t)MIN(p_adv_report->data.len, REPORT_CODEC_DATA_MAX),
+            .p_data = p_adv_report->data.p_data,
+        };
+    memcpy(rec.addr, p_adv_report->peer_addr.addr, BLE_GAP_ADDR_LEN);
+
+    if ((index < 0) || !address_list[index].announced)
+    {
+        len = report_encode_dev(&m_report_codec, &rec, frame);
+        if (index >= 0)
+        {
+            address_list[index].announced = true;
+        }
+    }
+    else
+    {
+        len = report_encode_rpt(&m_report_codec, &rec, frame);
+    }
+
+    report_frame_write(frame, len);
+}
+#endif
+
+/**@brief Function for forcing every address to be announced again.
+ *
+ * @details Called periodically so that a host that started listening after a device was first
+ *          reported can still rebuild the index to address dictionary.
+ */
+void address_list_resync(void)
+{
+    for (int i = 0; i < address_list_length; i++)
+    {
+        address_list[i].announced = false;
+    }
+    reports_since_resync = 0;
+    NRF_LOG_INFO("dev dict resync: %d entries", address_list_length);
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+    report_sync_output();
+#endif
 }
 
-void print_address(const ble_gap_evt_adv_report_t *p_adv_report)
+void print_address(int index, const ble_gap_evt_adv_report_t *p_adv_report)
 {
-    NRF_LOG_INFO("addr: %02x:%02x:%02x:%02x:%02x:%02x",
-                 p_adv_report->peer_addr.addr[5],
-                 p_adv_report->peer_addr.addr[4],
-                 p_adv_report->peer_addr.addr[3],
-                 p_adv_report->peer_addr.addr[2],
-                 p_adv_report->peer_addr.addr[1],
-                 p_adv_report->peer_addr.addr[0]);
+    char addr_string[18];
+
+    sprintf(addr_string, "%02x:%02x:%02x:%02x:%02x:%02x",
+            p_adv_report->peer_addr.addr[5],
+            p_adv_report->peer_addr.addr[4],
+            p_adv_report->peer_addr.addr[3],
+            p_adv_report->peer_addr.addr[2],
+            p_adv_report->peer_addr.addr[1],
+            p_adv_report->peer_addr.addr[0]);
+
+    if (index < 0)
+    {
+        // Dictionary is full, the device can only be identified by its address.
+        NRF_LOG_INFO("addr: %s", nrf_log_push(addr_string));
+    }
+    else if (!address_list[index].announced)
+    {
+        NRF_LOG_INFO("dev %d = %s", index, nrf_log_push(addr_string));
+        address_list[index].announced = true;
+    }
+    else
+    {
+        NRF_LOG_INFO("dev %d", index);
+    }
 }
 
-void print_name(const ble_gap_evt_adv_report_t *p_adv_report, char *pName)
+/**@brief Function for copying the complete or short local name of a device into pName.
+ *
+ * @details Extended advertising data can carry names longer than the buffer; they are cut to
+ *          size - 1 characters. pName is always NUL-terminated.
+ */
+void name_get(const ble_gap_evt_adv_report_t *p_adv_report, char *pName, size_t size)
 {
     uint16_t offset = 0;
 
@@ -134,16 +987,23 @@ void print_name(const ble_gap_evt_adv_report_t *p_adv_report, char *pName)
 
     if (length != 0)
     {
+        length = MIN(length, size - 1);
         memcpy(pName, &p_adv_report->data.p_data[offset], length);
-        NRF_LOG_INFO("name: %s", nrf_log_push(pName));
+        pName[length] = '\0';
     }
     else
     {
-        strcpy(pName, "No-Name");
-        NRF_LOG_INFO("name: %s", nrf_log_push(pName));
+        strncpy(pName, "No-Name", size - 1);
+        pName[size - 1] = '\0';
     }
 }
 
+void print_name(const ble_gap_evt_adv_report_t *p_adv_report, char *pName, size_t size)
+{
+    name_get(p_adv_report, pName, size);
+    NRF_LOG_INFO("name: %s", nrf_log_push(pName));
+}
+
 void print_manufacturer_data(const ble_gap_evt_adv_report_t *p_adv_report)
 {
     uint16_t offset = 0;
@@ -163,24 +1023,158 @@ void print_manufacturer_data(const ble_gap_evt_adv_report_t *p_adv_report)
     }
 }
 
+/**@brief Function for stamping every BLE event before any other observer sees it.
+ */
+static void timestamp_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
+{
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+    // Polled, the event is dispatched up to a few budgets after it arrived, see sd_evts_poll().
+    m_evt_timestamp = m_evt_poll_ts;
+#else
+    m_evt_timestamp = timestamp_get();
+#endif
+    m_evt_cycles = DWT->CYCCNT;
+}
+
+#if (SCAN_DIRECT == 1)
+static void scan_report_handle(const ble_gap_evt_adv_report_t *p_adv_report);
+#endif
+static void scan_timeout_post(void);
+#if (SCAN_WHILE_CONNECTED == 1)
+static void conn_scan_start(uint16_t conn_interval);
+static void conn_scan_stop(void);
+static void conn_scan_account(void);
+#endif
+
+/**@brief Function for starting the primary service discovery, the discovering state's entry action.
+ */
+static ret_code_t sm_discover(uint16_t conn_handle)
+{
+    m_discovered_services = 0;
+    return sd_ble_gattc_primary_services_discover(conn_handle, 0x0001, NULL);
+}
+
+/**@brief Function for cancelling the connect request.
+ */
+static ret_code_t sm_connect_cancel(void)
+{
+    return sd_ble_gap_connect_cancel();
+}
+
+/**@brief Function for disconnecting the link.
+ */
+static ret_code_t sm_disconnect(uint16_t conn_handle)
+{
+    return sd_ble_gap_disconnect(conn_handle, BLE_HCI_REMOTE_USER_TERMINATED_CONNECTION);
+}
+
+/**@brief Function for continuing the primary service discovery with each response.
+ */
+static void discovery_on_rsp(ble_gattc_evt_t const *p_gattc_evt)
+{
+    ble_gattc_evt_prim_srvc_disc_rsp_t const *p_rsp = &p_gattc_evt->params.prim_srvc_disc_rsp;
+    conn_sm_evt_t evt = {.type = CONN_SM_EVT_DISCOVERY_FAILED};
+
+    if (p_gattc_evt->gatt_status == BLE_GATT_STATUS_ATTERR_ATTRIBUTE_NOT_FOUND)
+    {
+        // No services past the last handle.
+        evt.type = CONN_SM_EVT_DISCOVERY_DONE;
+    }
+    else if ((p_gattc_evt->gatt_status == BLE_GATT_STATUS_SUCCESS) && (p_rsp->count > 0))
+    {
+        uint16_t end_handle = p_rsp->services[p_rsp->count - 1].handle_range.end_handle;
+
+        m_discovered_services += p_rsp->count;
+        if (end_handle == 0xFFFF)
+        {
+            evt.type = CONN_SM_EVT_DISCOVERY_DONE;
+        }
+        else if (sd_ble_gattc_primary_services_discover(p_gattc_evt->conn_handle, end_handle + 1, NULL) == NRF_SUCCESS)
+        {
+            return;
+        }
+    }
+
+    NRF_LOG_INFO("discovery %s: %u primary services",
+                 (evt.type == CONN_SM_EVT_DISCOVERY_DONE) ? "done" : "failed",
+                 m_discovered_services);
+    conn_sm_evt_put(&evt);
+}
+
 static void ble_evt_handler(ble_evt_t const *p_ble_evt, void *p_context)
 {
+    conn_sm_evt_t sm_evt = {.type = CONN_SM_EVT_NONE};
 
     switch (p_ble_evt->header.evt_id)
     {
     case BLE_GAP_EVT_CONNECTED:
         nrf_gpio_pin_clear(29);
         NRF_LOG_INFO("Connected!!");
+        NRF_LOG_INFO("report %u us, connect call +%u us, connected +%u us",
+                     m_connect_report_ts,
+                     m_connect_call_ts - m_connect_report_ts,
+                     m_evt_timestamp - m_connect_report_ts);
+        {
+            uint32_t latency = m_evt_timestamp - m_connect_report_ts;
+            connect_stats_t *p_stats = &m_connect_stats[m_connect_lane];
+
+            p_stats->connected++;
+            p_stats->connected_total_us += latency;
+            p_stats->connected_max_us = MAX(p_stats->connected_max_us, latency);
+        }
+#if (SCAN_WHILE_CONNECTED == 1)
+        conn_scan_start(p_ble_evt->evt.gap_evt.params.connected.conn_params.max_conn_interval);
+#endif
+        sm_evt.type = CONN_SM_EVT_CONNECTED;
+        sm_evt.params.conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
+        break;
+#if (SCAN_WHILE_CONNECTED == 1)
+    case BLE_GAP_EVT_CONN_PARAM_UPDATE:
+        conn_scan_start(p_ble_evt->evt.gap_evt.params.conn_param_update.conn_params.max_conn_interval);
         break;
+#endif
     case BLE_GAP_EVT_DISCONNECTED:
         NRF_LOG_INFO("Disconnected!!");
+#if (SCAN_WHILE_CONNECTED == 1)
+        conn_scan_stop();
+#endif
+        sm_evt.type = CONN_SM_EVT_DISCONNECTED;
         break;
+    case BLE_GATTC_EVT_PRIM_SRVC_DISC_RSP:
+        discovery_on_rsp(&p_ble_evt->evt.gattc_evt);
+        break;
+#if (SCAN_DIRECT == 1)
+    case BLE_GAP_EVT_ADV_REPORT:
+        scan_report_handle(&p_ble_evt->evt.gap_evt.params.adv_report);
+        break;
+#endif
     case BLE_GAP_EVT_TIMEOUT:
-        NRF_LOG_INFO("Connection Request timed out.");
+        switch (p_ble_evt->evt.gap_evt.params.timeout.src)
+        {
+        case BLE_GAP_TIMEOUT_SRC_CONN:
+            NRF_LOG_INFO("Connection Request timed out.");
+            sm_evt.type = CONN_SM_EVT_CONNECT_FAILED;
+            break;
+        case BLE_GAP_TIMEOUT_SRC_SCAN:
+#if (SCAN_DIRECT == 1)
+            scan_timeout_post();
+#else
+            // nrf_ble_scan raises NRF_BLE_SCAN_EVT_SCAN_TIMEOUT for it, see scan_evt_handler().
+#endif
+            break;
+        default:
+            NRF_LOG_DEBUG("GAP timeout, src %u", p_ble_evt->evt.gap_evt.params.timeout.src);
+            break;
+        }
         break;
     default:
         break;
     }
+
+    if (sm_evt.type != CONN_SM_EVT_NONE)
+    {
+        conn_sm_evt_put(&sm_evt);
+    }
 }
 
 /**@brief Function for initializing the BLE stack.
@@ -204,99 +1198,1901 @@ static void ble_stack_init(void)
     err_code = nrf_sdh_ble_enable(&ram_start);
     APP_ERROR_CHECK(err_code);
     // Register a handler for BLE events.
+    NRF_SDH_BLE_OBSERVER(m_timestamp_observer, TIMESTAMP_OBSERVER_PRIO, timestamp_evt_handler, NULL);
     NRF_SDH_BLE_OBSERVER(m_ble_observer, APP_BLE_OBSERVER_PRIO, ble_evt_handler, NULL);
 }
 
-/**@brief Function to start scanning.
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+NRF_SECTION_DEF(sdh_ble_observers, nrf_sdh_ble_evt_observer_t);
+NRF_SECTION_DEF(sdh_soc_observers, nrf_sdh_soc_evt_observer_t);
+
+static poll_stats_t m_poll_stats; /**< SoftDevice event polling statistics since the last log line. */
+
+/**@brief SoftDevice event interrupt.
+ *
+ * @details With NRF_SDH_DISPATCH_MODEL_POLLING nrf_sdh leaves the interrupt to the application,
+ *          which uses it to wake the main loop and to note when the oldest event still to be
+ *          fetched arrived; the events are fetched by @ref sd_evts_poll.
  */
-static void scan_start(void)
+void SD_EVT_IRQHandler(void)
 {
-
-    NRF_LOG_INFO("/****  Starting scan ****/");
-    memset(&address_list, 0, sizeof(address_list));
+    if (!m_evt_signalled)
+    {
+        m_evt_signal_ts = timestamp_get();
+        m_evt_signalled = true;
+    }
+}
+
+/**@brief Function for dispatching pending SoftDevice events to the observers, in the main loop.
+ *
+ * @details Unlike nrf_sdh_evts_poll(), which drains every pending event, at most @p budget BLE
+ *          and SoC events are dispatched so output and housekeeping get their turn under a
+ *          burst of advertising reports. Observers are called in priority order, as nrf_sdh_ble
+ *          and nrf_sdh_soc do.
+ *          tools/dispatch_sim.c models the event latency and loss of this against the interrupt
+ *          model for given budgets.
+ *
+ * @return True if the budget was used up and events may be left.
+ */
+static bool sd_evts_poll(uint32_t budget)
+{
+    uint32_t count = 0;
+    uint32_t soc_evt;
+    ret_code_t err_code;
+    uint32_t check_ts = 0;
+    bool drained = false;
+
+    // Every event fetched in this iteration is stamped with the time the oldest pending one was
+    // signalled. An event signalled meanwhile is stamped a little early; one left over from an
+    // iteration that used up its budget up to an iteration late.
+    CRITICAL_REGION_ENTER();
+    m_evt_poll_ts = m_evt_signalled ? m_evt_signal_ts : timestamp_get();
+    m_evt_signalled = false;
+    CRITICAL_REGION_EXIT();
+
+    while (count < budget)
+    {
+        __ALIGN(4) uint8_t evt_buffer[NRF_SDH_BLE_EVT_BUF_SIZE];
+        uint16_t evt_len = (uint16_t)sizeof(evt_buffer);
+
+        check_ts = timestamp_get();
+        err_code = sd_ble_evt_get(evt_buffer, &evt_len);
+        if (err_code == NRF_ERROR_NOT_FOUND)
+        {
+            drained = true;
+            break;
+        }
+        APP_ERROR_CHECK(err_code);
+
+        for (uint32_t i = 0; i < NRF_SECTION_ITEM_COUNT(sdh_ble_observers, nrf_sdh_ble_evt_observer_t); i++)
+        {
+            nrf_sdh_ble_evt_observer_t *p_observer = NRF_SECTION_ITEM_GET(sdh_ble_observers, nrf_sdh_ble_evt_observer_t, i);
+            p_observer->handler((ble_evt_t const *)evt_buffer, p_observer->p_context);
+        }
+        count++;
+    }
+
+    while ((count < budget) && (sd_evt_get(&soc_evt) == NRF_SUCCESS))
+    {
+        for (uint32_t i = 0; i < NRF_SECTION_ITEM_COUNT(sdh_soc_observers, nrf_sdh_soc_evt_observer_t); i++)
+        {
+            nrf_sdh_soc_evt_observer_t *p_observer = NRF_SECTION_ITEM_GET(sdh_soc_observers, nrf_sdh_soc_evt_observer_t, i);
+            p_observer->handler(soc_evt, p_observer->p_context);
+        }
+        count++;
+    }
+
+    m_poll_stats.iterations++;
+    m_poll_stats.events += count;
+    if (count == budget)
+    {
+        // Events are left that arrived no later than now, unless one was signalled meanwhile.
+        CRITICAL_REGION_ENTER();
+        if (!m_evt_signalled)
+        {
+            m_evt_signal_ts = timestamp_get();
+            m_evt_signalled = true;
+        }
+        CRITICAL_REGION_EXIT();
+        m_poll_stats.saturated++;
+        return true;
+    }
+    if (drained)
+    {
+        // An event signalled before the queue was found empty has been fetched above; its
+        // signal must not stamp the next event.
+        CRITICAL_REGION_ENTER();
+        if (m_evt_signalled && ((int32_t)(m_evt_signal_ts - check_ts) <= 0))
+        {
+            m_evt_signalled = false;
+        }
+        CRITICAL_REGION_EXIT();
+    }
+
+    return false;
+}
+
+/**@brief Function for processing at most @p budget deferred log entries.
+ *
+ * @return True if log entries are left.
+ */
+static bool log_process(uint32_t budget)
+{
+    while (budget-- > 0)
+    {
+        if (!NRF_LOG_PROCESS())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+/**@brief Function for deciding whether a report of a device is passed on, see @ref REPORT_POLICY.
+ *
+ * @details The rate limiter is a token bucket kept as the time at which the bucket is full
+ *          again (GCRA), so it costs four bytes per device and one comparison per report.
+ *          Devices that did not fit in the dictionary are always reported.
+ */
+static bool report_admit(int index, uint32_t timestamp)
+{
+    if (index < 0)
+    {
+        return true;
+    }
+
+#if (REPORT_POLICY == REPORT_POLICY_DEDUP)
+    if ((uint16_t)(m_dedup_bucket - address_list[index].seen_bucket) < DEDUP_BUCKETS)
+    {
+        return false;
+    }
+    address_list[index].seen_bucket = m_dedup_bucket;
+    return true;
+#elif (REPORT_POLICY == REPORT_POLICY_RATE_LIMIT)
+    rate_limit_t const *p_limit = &m_rate_limits[address_list[index].device_class];
+    uint32_t tat = address_list[index].rate_tat;
+    uint32_t tolerance = p_limit->interval_us * (p_limit->burst - 1);
+
+    // Bucket idle long enough to be full: restart from now. A bucket can never be more than
+    // one interval past the tolerance ahead of now, so anything further is a stale entry from
+    // before a timestamp wrap (or a new one) and is treated as full too.
+    if (((int32_t)(timestamp - tat) > 0) || ((tat - timestamp) > tolerance + p_limit->interval_us))
+    {
+        tat = timestamp;
+    }
+    // Bucket empty.
+    if ((int32_t)(tat - timestamp) > (int32_t)tolerance)
+    {
+        return false;
+    }
+    address_list[index].rate_tat = tat + p_limit->interval_us;
+    return true;
+#else
+    return true;
+#endif
+}
+
+/**@brief Function for (re)starting the scanner with @ref m_scan_param.
+ */
+static void scan_radio_start(void)
+{
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+    // nrf_ble_scan starts with its own buffer.
+    m_scan_buffer.p_data = NULL;
+#endif
+#if (SCAN_DIRECT == 1)
+    m_scan_stopped = false;
+    UNUSED_RETURN_VALUE(sd_ble_gap_scan_stop());
+#else
+    // nrf_ble_scan keeps its own copy of the parameters. Stops the scan.
+    APP_ERROR_CHECK(nrf_ble_scan_params_set(&m_scan, &m_scan_param));
+#endif
+#if (SCAN_WHITELIST == 1)
+    // The whitelist can only be changed while no scan uses it.
+    if (m_scan_param.filter_policy == BLE_GAP_SCAN_FP_WHITELIST)
+    {
+        APP_ERROR_CHECK(sd_ble_gap_whitelist_set(m_whitelist_ptrs, m_whitelist_len));
+    }
+#endif
+#if (SCAN_DIRECT == 1)
+    APP_ERROR_CHECK(sd_ble_gap_scan_start(&m_scan_param, &m_scan_data_buffer));
+#else
     APP_ERROR_CHECK(nrf_ble_scan_start(&m_scan));
+#endif
+}
+
+/**@brief Function to start scanning.
+ */
+static void scan_start(void)
+{
+
+    NRF_LOG_INFO("/****  Starting scan ****/");
+#if (SCAN_CONTINUOUS == 0)
+    // Only the per-window dedup is reset, device indexes stay valid across scan windows.
+    // Moving on a whole window marks every device as not seen.
+    m_dedup_bucket += DEDUP_BUCKETS;
+#endif
+    scan_radio_start();
+#if (SCAN_CONTINUOUS == 0)
+    uint32_t now = timestamp_get();
+
+    if (m_scan_gap.pending)
+    {
+        // Reports lost while the radio was off, at the rate of the window that timed out.
+        uint32_t gap = now - m_scan_gap.timeout_ts;
+        uint32_t window = m_scan_gap.timeout_ts - m_scan_gap.window_start_ts;
+
+        m_scan_gap.pending = false;
+        m_scan_gap.restarts++;
+        m_scan_gap.gap_us += gap;
+        if (window > 0)
+        {
+            m_scan_gap.lost_reports += (uint32_t)(((uint64_t)m_scan_gap.window_reports * gap) / window);
+        }
+    }
+    m_scan_gap.window_start_ts = now;
+    m_scan_gap.window_reports = 0;
+#endif
+}
+
+/**@brief Function to stop scanning.
+ */
+static void scan_stop(void)
+{
+#if (SCAN_DIRECT == 1)
+    m_scan_stopped = true;
+    UNUSED_RETURN_VALUE(sd_ble_gap_scan_stop());
+#else
+    nrf_ble_scan_stop();
+#endif
+}
+
+/**@brief Function for checking whether a report comes from the device to connect to.
+ *
+ * @details Runs for every report in the SoftDevice event handler. The advertising data is walked
+ *          once and the local name compared in place, the complete name taking precedence over
+ *          the short one as in name_get().
+ */
+static bool target_match(const ble_gap_evt_adv_report_t *p_adv_report)
+{
+    uint8_t const *p_data = p_adv_report->data.p_data;
+    uint16_t data_len = p_adv_report->data.len;
+    uint8_t const *p_short = NULL;
+    uint16_t short_len = 0;
+    uint16_t pos = 0;
+
+    while (pos + 1 < data_len)
+    {
+        uint8_t field_len = p_data[pos];
+
+        if ((field_len == 0) || (pos + 1 + field_len > data_len))
+        {
+            break;
+        }
+        if (p_data[pos + 1] == BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME)
+        {
+            return (field_len - 1 == sizeof(TARGET_DEVICE_NAME) - 1) &&
+                   (memcmp(&p_data[pos + 2], TARGET_DEVICE_NAME, field_len - 1) == 0);
+        }
+        if ((p_data[pos + 1] == BLE_GAP_AD_TYPE_SHORT_LOCAL_NAME) && (p_short == NULL))
+        {
+            p_short = &p_data[pos + 2];
+            short_len = field_len - 1;
+        }
+        pos += 1 + field_len;
+    }
+    return (p_short != NULL) &&
+           (short_len == sizeof(TARGET_DEVICE_NAME) - 1) &&
+           (memcmp(p_short, TARGET_DEVICE_NAME, short_len) == 0);
+}
+
+/**@brief Function for getting the number of PHYs scanned in turn.
+ */
+static uint8_t scan_phy_count(uint8_t scan_phys)
+{
+    return (scan_phys == (BLE_GAP_PHY_1MBPS | BLE_GAP_PHY_CODED)) ? 2 : 1;
+}
+
+/**@brief Function for getting the radio duty of a set of scan parameters, in permille.
+ */
+static uint16_t scan_duty_permille(ble_gap_scan_params_t const *p_params)
+{
+    return (uint16_t)((p_params->window * scan_phy_count(p_params->scan_phys) * 1000UL) / p_params->interval);
+}
+
+/**@brief Function for stopping the scan and connecting, the connecting state's entry action.
+ *
+ * @details On a name filter match nrf_ble_scan has already stopped the scan and called
+ *          sd_ble_gap_connect() before reporting it; only its result is taken over.
+ */
+static ret_code_t sm_connect(ble_gap_addr_t const *p_peer_addr)
+{
+    ret_code_t err_code;
+    uint16_t duty;
+
+    nrf_gpio_pin_set(29);
+    m_connect_report_ts = m_target_report_ts;
+    m_connect_lane = m_target_lane;
+#if (SCAN_TARGET_FILTER == 1)
+    if (m_target_lane == CONNECT_LANE_FILTER)
+    {
+        // nrf_ble_scan connects with its copy of the scan parameters, at the current duty level;
+        // the duty is logged with the lane so the lanes' connection times can be compared.
+        m_connect_call_ts = timestamp_get();
+        err_code = m_filter_connect_err;
+        duty = m_filter_connect_duty;
+    }
+    else
+#endif
+    {
+        // Connect at the profile's full duty whatever the scan duty level. With the whitelist
+        // policy the SoftDevice would connect to any whitelisted device instead of p_peer_addr.
+        ble_gap_scan_params_t connect_scan_param = m_scan_param;
+        connect_scan_param.interval = m_scan_profile->duty.interval;
+        connect_scan_param.window = m_scan_profile->duty.window;
+        connect_scan_param.filter_policy = BLE_GAP_SCAN_FP_ACCEPT_ALL;
+        duty = scan_duty_permille(&connect_scan_param);
+
+        scan_stop();
+        m_connect_call_ts = timestamp_get();
+        err_code = sd_ble_gap_connect(p_peer_addr,
+                                      &connect_scan_param,
+                                      m_scan_profile->p_conn_param,
+                                      APP_BLE_CONN_CFG_TAG);
+    }
+
+    uint32_t latency = m_connect_call_ts - m_connect_report_ts;
+    CRITICAL_REGION_ENTER();
+    m_connect_stats[m_target_lane].count++;
+    m_connect_stats[m_target_lane].latency_total_us += latency;
+    m_connect_stats[m_target_lane].duty_total += duty;
+    if (latency > m_connect_stats[m_target_lane].latency_max_us)
+    {
+        m_connect_stats[m_target_lane].latency_max_us = latency;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (err_code != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("sd_ble_gap_connect() failed: 0x%x.\r\n", err_code);
+    }
+    else
+        NRF_LOG_ERROR("sd_ble_gap_connect() !!: 0x%x.\r\n", err_code);
+
+    return err_code;
+}
+
+/**@brief Function for passing a report of the target device to the connection state machine.
+ *
+ * @details The state machine only connects while it is scanning; later reports of the target
+ *          are ignored.
+ *
+ * @param[in] p_adv_report Advertising report of the target device.
+ * @param[in] timestamp    Timestamp of the report's BLE event.
+ * @param[in] lane         Path the report came through, for the latency statistics.
+ */
+static void target_connect(const ble_gap_evt_adv_report_t *p_adv_report, uint32_t timestamp, connect_lane_t lane)
+{
+    conn_sm_evt_t evt = {.type = CONN_SM_EVT_TARGET_FOUND, .params.p_peer_addr = &p_adv_report->peer_addr};
+    conn_state_t state;
+
+    // Only the first matching report of a scan starts a connect; later ones must not overwrite
+    // the timestamp and lane of the connect in progress.
+    CRITICAL_REGION_ENTER();
+    state = conn_sm_state_get();
+    if ((state == CONN_STATE_SCANNING) || (state == CONN_STATE_RECONNECTING))
+    {
+        m_target_report_ts = timestamp;
+        m_target_lane = lane;
+        conn_sm_evt_put(&evt);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+#if (REPORT_DEFERRED_PROCESSING == 1)
+/**@brief Function for getting the shedding class of a dictionary entry.
+ */
+static uint8_t report_class_get(address_entry_t const *p_entry)
+{
+    if (p_entry->device_class == DEVICE_CLASS_TARGET)
+    {
+        return REPORT_CLASS_TARGET;
+    }
+    if (p_entry->reports >= REPORT_TRACKED_MIN)
+    {
+        return REPORT_CLASS_TRACKED;
+    }
+    return REPORT_CLASS_KNOWN;
+}
+
+/**@brief Function for publishing the shedding class of a dictionary entry to @ref m_class_map.
+ */
+static void report_class_publish(int index)
+{
+    uint8_t *p_bucket = &m_class_map[REPORT_CLASS_HASH(address_list[index].addr)];
+
+    *p_bucket = MAX(*p_bucket, report_class_get(&address_list[index]));
+}
+
+/**@brief Function for aging the report counts and rebuilding @ref m_class_map, every
+ *        REPORT_CLASS_AGE_MS in the main loop.
+ *
+ * @details Publishing only ever raises a bucket. Halving the counts lets a device that stopped
+ *          reporting fall back from tracked to known, and the rebuild drops the classes of
+ *          evicted devices. Each bucket is written once, so the handler reads either its old or
+ *          its new class.
+ */
+static void report_class_age(void *p_event_data, uint16_t event_size)
+{
+    uint8_t map[REPORT_CLASS_MAP_SIZE] = {0};
+
+    for (int i = 0; i < address_list_length; i++)
+    {
+        uint8_t *p_bucket = &map[REPORT_CLASS_HASH(address_list[i].addr)];
+
+        address_list[i].reports /= 2;
+        *p_bucket = MAX(*p_bucket, report_class_get(&address_list[i]));
+    }
+    for (int i = 0; i < REPORT_CLASS_MAP_SIZE; i++)
+    {
+        m_class_map[i] = map[i];
+    }
+}
+
+static void class_timeout_handler(void *p_context)
+{
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, report_class_age));
+}
+#endif
+
+#if (RSSI_GATE == 1)
+/**@brief Function for getting the RSSI floor of a dictionary entry, lowered once it was reached.
+ */
+static int8_t rssi_floor_get(address_entry_t const *p_entry)
+{
+    int16_t floor = m_rssi_floor[p_entry->device_class];
+
+    if (p_entry->rssi_admitted)
+    {
+        floor -= RSSI_HYSTERESIS;
+    }
+    return (int8_t)MAX(floor, INT8_MIN);
+}
+
+/**@brief Function for publishing the RSSI floor of a dictionary entry to @ref m_rssi_floor_map.
+ */
+static void rssi_floor_publish(int index)
+{
+    int8_t *p_bucket = &m_rssi_floor_map[REPORT_CLASS_HASH(address_list[index].addr)];
+
+    *p_bucket = MIN(*p_bucket, rssi_floor_get(&address_list[index]));
+}
+
+/**@brief Function for rebuilding @ref m_rssi_floor_map from the floors and the dictionary.
+ *
+ * @details Buckets without a known device get the floor of @ref DEVICE_CLASS_OTHER. Each bucket
+ *          is written once, so the gate reads either its old or its new floor.
+ */
+static void rssi_floor_map_build(void)
+{
+    int8_t map[REPORT_CLASS_MAP_SIZE];
+
+    memset(map, m_rssi_floor[DEVICE_CLASS_OTHER], sizeof(map));
+    m_rssi_admitted = 0;
+    for (int i = 0; i < address_list_length; i++)
+    {
+        int8_t *p_bucket = &map[REPORT_CLASS_HASH(address_list[i].addr)];
+
+        *p_bucket = MIN(*p_bucket, rssi_floor_get(&address_list[i]));
+        m_rssi_admitted += address_list[i].rssi_admitted;
+    }
+    for (int i = 0; i < REPORT_CLASS_MAP_SIZE; i++)
+    {
+        m_rssi_floor_map[i] = map[i];
+    }
+}
+
+/**@brief Function for updating a device's RSSI hysteresis from one of its reports.
+ *
+ * @details A device reaching its floor has it lowered by RSSI_HYSTERESIS, so a signal around the
+ *          floor does not make its reports come and go. Reports below the lowered floor never
+ *          get here; the floor is raised again by @ref rssi_floor_check once none came above it
+ *          for RSSI_HOLD_MS.
+ */
+static void rssi_floor_track(int index, int8_t rssi, uint32_t timestamp)
+{
+    address_entry_t *p_entry = &address_list[index];
+
+    if (rssi < rssi_floor_get(p_entry))
+    {
+        // Passed on the lower floor of a device in the same bucket.
+        return;
+    }
+    p_entry->rssi_ts = timestamp;
+    if (!p_entry->rssi_admitted)
+    {
+        p_entry->rssi_admitted = true;
+        m_rssi_admitted++;
+        rssi_floor_publish(index);
+    }
+}
+#endif
+
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+/**@brief Function for updating a device's scan response state from one of its reports.
+ */
+static void scan_rsp_track(address_entry_t *p_entry, const ble_gap_evt_adv_report_t *p_adv_report)
+{
+    p_entry->seen_tick = m_scan_rsp_tick;
+    if (p_adv_report->type.scan_response)
+    {
+        p_entry->scan_rsp = SCAN_RSP_RECEIVED;
+        p_entry->rsp_tick = m_scan_rsp_tick;
+    }
+    else if (p_adv_report->type.scannable && (p_entry->scan_rsp == SCAN_RSP_NONE))
+    {
+        p_entry->scan_rsp = SCAN_RSP_MISSING;
+        p_entry->rsp_tick = m_scan_rsp_tick;
+    }
+}
+#endif
+
+/**@brief Function for processing one advertising report: dedup, output and connect.
+ *
+ * @param[in] p_adv_report     Advertising report.
+ * @param[in] timestamp        Timestamp of the report's BLE event.
+ * @param[in] connect_on_match Connect if the report is from the target device. False if the
+ *                             fast lane already did.
+ */
+static void report_process(const ble_gap_evt_adv_report_t *p_adv_report, uint32_t timestamp, bool connect_on_match)
+{
+    int index = address_list_find(p_adv_report->peer_addr.addr);
+    if (index < 0)
+    {
+        index = address_list_add(p_adv_report->peer_addr.addr);
+    }
+    if (index >= 0)
+    {
+        address_list[index].report_seq = ++m_report_seq;
+    }
+    if ((index >= 0) && (address_list[index].reports < UINT8_MAX))
+    {
+        address_list[index].reports++;
+#if (REPORT_DEFERRED_PROCESSING == 1)
+        report_class_publish(index);
+#endif
+    }
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+    if (index >= 0)
+    {
+        scan_rsp_track(&address_list[index], p_adv_report);
+    }
+#endif
+#if (RSSI_GATE == 1)
+    if (index >= 0)
+    {
+        rssi_floor_track(index, p_adv_report->rssi, timestamp);
+    }
+#endif
+
+    if (!report_admit(index, timestamp))
+    {
+        return;
+    }
+
+    if (++reports_since_resync >= ADDRESS_DICT_RESYNC_REPORTS)
+    {
+        address_list_resync();
+    }
+
+    /*switch (p_adv_report->peer_addr.addr_type) {
+        case BLE_GAP_ADDR_TYPE_PUBLIC:
+            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_PUBLIC");
+            break;
+        case BLE_GAP_ADDR_TYPE_RANDOM_STATIC:
+            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_STATIC");
+            break;
+        case BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_RESOLVABLE:
+            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_RESOLVABLE");
+            break;
+        case BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_NON_RESOLVABLE:
+            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_NON_RESOLVABLE");
+            break;
+        case BLE_GAP_ADDR_TYPE_ANONYMOUS:
+            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_ANONYMOUS");
+            break;
+    }*/
+    char name[DEV_NAME_LEN] = {0};
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+    report_output(index, p_adv_report, timestamp);
+#else
+    NRF_LOG_INFO("    ");
+    NRF_LOG_INFO("    ");
+    print_address(index, p_adv_report);
+    print_name(p_adv_report, name, sizeof(name));
+    NRF_LOG_INFO("rssi: %d", p_adv_report->rssi);
+    NRF_LOG_INFO("phy: %s", (p_adv_report->primary_phy == BLE_GAP_PHY_CODED) ? "coded" : "1M");
+    NRF_LOG_INFO("ts: %u us", timestamp);
+    print_manufacturer_data(p_adv_report);
+    NRF_LOG_INFO("    ");
+    NRF_LOG_INFO("    ");
+#endif
+
+    // If device is found
+    if (target_match(p_adv_report))
+    {
+        if (index >= 0)
+        {
+            address_list[index].device_class = DEVICE_CLASS_TARGET;
+            address_list[index].addr_type = p_adv_report->peer_addr.addr_type;
+#if (REPORT_DEFERRED_PROCESSING == 1)
+            report_class_publish(index);
+#endif
+#if (RSSI_GATE == 1)
+            rssi_floor_publish(index);
+#endif
+        }
+        NRF_LOG_INFO("--Device Found--");
+        // Connect Now
+        if (connect_on_match)
+        {
+            target_connect(p_adv_report, timestamp, CONNECT_LANE_BULK);
+        }
+        NRF_LOG_INFO("--Scanning stopped--");
+        print_name(p_adv_report, name, sizeof(name));
+        print_address(index, p_adv_report);
+        print_manufacturer_data(p_adv_report);
+    }
+}
+
+#if (REPORT_DEFERRED_PROCESSING == 1)
+/**@brief Function for copying a report into the next free slot of a report ring.
+ *
+ * @details A full ring drops the report.
+ */
+static void report_enqueue(report_ring_t *p_ring,
+                           scan_report_t *p_slots,
+                           const ble_gap_evt_adv_report_t *p_adv_report,
+                           uint32_t timestamp)
+{
+    uint32_t slot;
+
+    if (report_ring_write_slot(p_ring, &slot))
+    {
+        scan_report_t *p_report = &p_slots[slot];
+
+        p_report->timestamp = timestamp;
+        p_report->adv_report = *p_adv_report;
+        p_report->adv_report.data.len = MIN(p_adv_report->data.len, REPORT_DATA_MAX);
+        memcpy(p_report->data, p_adv_report->data.p_data, p_report->adv_report.data.len);
+        report_ring_commit(p_ring);
+    }
+}
+
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+/**@brief Function for resuming the scan into the data buffer of the next free report slot.
+ *
+ * @details The SoftDevice pauses scanning after every report until it gets a buffer back.
+ *          nrf_ble_scan resumes with its single buffer after @ref scan_evt_handler returns; here
+ *          a free slot is handed out as soon as the report is queued instead, and nrf_ble_scan's
+ *          own resume fails harmlessly. If the main loop still holds every slot nothing is
+ *          handed out and the scan resumes with the scanner's own buffer as usual.
+ *
+ * @retval true  The scan was resumed.
+ * @retval false No slot was free.
+ */
+static bool scan_buffer_rotate(void)
+{
+    uint32_t slot;
+
+    if (!report_ring_free_slot(&m_report_ring, &slot))
+    {
+        m_scan_buffer.p_data = NULL;
+        return false;
+    }
+
+    m_scan_buffer.p_data = m_report_slots[slot].data;
+    m_scan_buffer.len = REPORT_DATA_MAX;
+    if (sd_ble_gap_scan_start(NULL, &m_scan_buffer) != NRF_SUCCESS)
+    {
+        m_scan_buffer.p_data = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/**@brief Function for queuing a report the SoftDevice wrote into the next free report slot.
+ */
+static void report_commit_in_place(const ble_gap_evt_adv_report_t *p_adv_report, uint32_t timestamp)
+{
+    uint32_t slot;
+
+    // The slot handed out by scan_buffer_rotate() is still the next one.
+    if (report_ring_write_slot(&m_report_ring, &slot))
+    {
+        scan_report_t *p_report = &m_report_slots[slot];
+
+        p_report->timestamp = timestamp;
+        p_report->adv_report = *p_adv_report;
+        report_ring_commit(&m_report_ring);
+    }
+}
+#endif
+
+/**@brief Function for processing the oldest report of a report ring.
+ *
+ * @return False if the ring is empty.
+ */
+static bool report_dequeue(report_ring_t *p_ring, scan_report_t *p_slots, bool connect_on_match)
+{
+    uint32_t slot;
+
+    if (!report_ring_read_slot(p_ring, &slot))
+    {
+        return false;
+    }
+
+    scan_report_t *p_report = &p_slots[slot];
+
+    p_report->adv_report.data.p_data = p_report->data;
+    report_process(&p_report->adv_report, p_report->timestamp, connect_on_match);
+    report_ring_release(p_ring);
+
+    return true;
+}
+
+/**@brief Function for processing up to @ref REPORT_BATCH_MAX queued reports, in the main loop.
+ *
+ * @details Reports of the fast lane are processed first. The output of the whole batch is
+ *          written at once.
+ *
+ * @return True if reports are left in the rings.
+ */
+static bool report_queue_process(void)
+{
+    uint32_t batch = 0;
+    uint32_t pending;
+
+    while (batch < REPORT_BATCH_MAX)
+    {
+#if (REPORT_FAST_LANE == 1)
+        if (report_dequeue(&m_fast_ring, m_fast_slots, false))
+        {
+            batch++;
+            continue;
+        }
+#endif
+        if (!report_dequeue(&m_report_ring, m_report_slots, true))
+        {
+            break;
+        }
+        batch++;
+    }
+
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+    report_batch_flush();
+#endif
+    m_batch_histogram[batch]++;
+
+    pending = report_ring_count(&m_report_ring);
+#if (REPORT_FAST_LANE == 1)
+    pending += report_ring_count(&m_fast_ring);
+#endif
+    return pending > 0;
+}
+#endif
+
+/**@brief Function for handling a scan timeout, in the main loop.
+ *
+ * @param[in] p_event_data Timestamp of the timeout event.
+ */
+static void scan_timeout_sched_handler(void *p_event_data, uint16_t event_size)
+{
+    conn_sm_evt_t evt = {.type = CONN_SM_EVT_SCAN_TIMEOUT};
+
+#if (SCAN_CONTINUOUS == 0)
+    m_scan_gap.timeout_ts = *(uint32_t const *)p_event_data;
+    m_scan_gap.pending = true;
+#endif
+    NRF_LOG_INFO("/****  Scan timed out ****/");
+    conn_sm_evt_put(&evt);
+}
+
+/**@brief Function for passing a scan timeout on to the main loop, in SoftDevice interrupt context.
+ *
+ * @details The scheduler queue is shared with the periodic timers and can be full while the
+ *          main loop is busy. The timeout is then left in @ref m_scan_timeout_missed for the
+ *          main loop to pick up, rather than asserting.
+ */
+static void scan_timeout_post(void)
+{
+    if (app_sched_event_put(&m_evt_timestamp, sizeof(m_evt_timestamp), scan_timeout_sched_handler) != NRF_SUCCESS)
+    {
+        m_scan_timeout_missed_ts = m_evt_timestamp;
+        m_scan_timeout_missed = true;
+    }
+}
+
+/**@brief Function for handling a scan timeout that did not fit in the scheduler queue, in the
+ *        main loop.
+ */
+static void scan_timeout_missed_process(void)
+{
+    if (m_scan_timeout_missed)
+    {
+        uint32_t timestamp = m_scan_timeout_missed_ts;
+
+        m_scan_timeout_missed = false;
+        scan_timeout_sched_handler(&timestamp, sizeof(timestamp));
+    }
+}
+
+/**@brief Function for incrementing a 16-bit counter without wrapping.
+ */
+static __INLINE void counter_u16_inc(uint16_t *p_counter)
+{
+    if (*p_counter < UINT16_MAX)
+    {
+        (*p_counter)++;
+    }
+}
+
+/**@brief Function for counting a report in the statistics of the channel it was received on.
+ *
+ * @details Reports of extended advertising data received on a secondary channel are not counted.
+ */
+static void channel_stats_count(const ble_gap_evt_adv_report_t *p_adv_report)
+{
+    uint8_t channel = (uint8_t)(p_adv_report->ch_index - ADV_CHANNEL_FIRST);
+    int8_t rssi = p_adv_report->rssi;
+    channel_stats_t *p_stats;
+
+    if (channel >= ADV_CHANNEL_COUNT)
+    {
+        return;
+    }
+
+    p_stats = &m_channel_stats[channel];
+    counter_u16_inc(&p_stats->reports);
+    if (p_adv_report->type.scan_response)
+    {
+        counter_u16_inc(&p_stats->scan_rsp);
+    }
+    else if (p_adv_report->type.scannable)
+    {
+        counter_u16_inc(&p_stats->scannable);
+    }
+    counter_u16_inc(&p_stats->rssi[(rssi > -60) ? 0 : (rssi > -75) ? 1 : (rssi > -90) ? 2 : 3]);
+}
+
+/**@brief Function for logging and resetting the channel statistics, flagging channels that
+ *        fall behind the best one.
+ */
+static void channel_stats_log(void)
+{
+    channel_stats_t stats[ADV_CHANNEL_COUNT];
+    uint16_t best = 0;
+
+    CRITICAL_REGION_ENTER();
+    memcpy(stats, m_channel_stats, sizeof(stats));
+    memset(m_channel_stats, 0, sizeof(m_channel_stats));
+    CRITICAL_REGION_EXIT();
+
+    for (int i = 0; i < ADV_CHANNEL_COUNT; i++)
+    {
+        best = MAX(best, stats[i].reports);
+    }
+
+    for (int i = 0; i < ADV_CHANNEL_COUNT; i++)
+    {
+        char channel_string[96];
+        uint32_t loss = (best > 0) ? ((uint32_t)(best - stats[i].reports) * 1000) / best : 0;
+
+        sprintf(channel_string, "%u reports, rssi %u/%u/%u/%u, scan rsp %u/%u, loss ~%u/1000",
+                stats[i].reports,
+                stats[i].rssi[0], stats[i].rssi[1], stats[i].rssi[2], stats[i].rssi[3],
+                stats[i].scan_rsp, stats[i].scannable,
+                (unsigned)loss);
+        NRF_LOG_INFO("ch %u: %s", ADV_CHANNEL_FIRST + i, nrf_log_push(channel_string));
+        if ((best >= ADV_CHANNEL_MIN_REPORTS) && (loss >= ADV_CHANNEL_LOSS_FLAG))
+        {
+            NRF_LOG_WARNING("ch %u: %u/1000 fewer reports than the best channel, interference?",
+                            ADV_CHANNEL_FIRST + i, loss);
+        }
+    }
+}
+
+#if (RSSI_GATE == 1)
+/**@brief Function for resuming the scan into the buffer of a report that is dropped.
+ */
+static __INLINE void scan_resume_dropped(void)
+{
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+    if (m_scan_buffer.p_data != NULL)
+    {
+        // The slot handed out stays the next one.
+        UNUSED_RETURN_VALUE(sd_ble_gap_scan_start(NULL, &m_scan_buffer));
+        return;
+    }
+#endif
+#if (SCAN_DIRECT == 1)
+    if (!m_scan_stopped)
+    {
+        UNUSED_RETURN_VALUE(sd_ble_gap_scan_start(NULL, &m_scan_data_buffer));
+    }
+#endif
+    // Otherwise nrf_ble_scan resumes the scan right after its handler.
+}
+#endif
+
+/**@brief Function for counting a report in the report density the duty controller and the
+ *        scan gap estimate work from, whether or not it passes the RSSI gate.
+ */
+static __INLINE void scan_report_count_on_air(void)
+{
+#if (SCAN_ADAPTIVE == 1)
+    m_scan_ctrl_reports++;
+#endif
+#if (SCAN_CONTINUOUS == 0)
+    m_scan_gap.window_reports++;
+#endif
+}
+
+/**@brief Function for handling an advertising report, in SoftDevice interrupt context.
+ *
+ * @details With @ref REPORT_DEFERRED_PROCESSING the report is only copied into the report
+ *          ring, everything else happens in the main loop. With @ref REPORT_SCAN_BUFFER_POOL
+ *          it is already in its slot and the scan resumes before the handler returns. The
+ *          cycles spent and the time the scan was paused are counted in every configuration so
+ *          they can be compared.
+ */
+static void scan_report_handle(const ble_gap_evt_adv_report_t *p_adv_report)
+{
+    uint32_t resume_ts = 0;
+    bool resumed = false;
+    bool waited = false;
+
+#if (RSSI_GATE == 1)
+    // First stage: one compare against the floor of the address's bucket. A report below the
+    // floor is only counted as on air for the duty controller and the scan gap estimate; the
+    // channel and handler statistics never see it.
+    if (p_adv_report->rssi < m_rssi_floor_map[REPORT_CLASS_HASH(p_adv_report->peer_addr.addr)])
+    {
+        m_rssi_rejected++;
+        scan_report_count_on_air();
+        scan_resume_dropped();
+        return;
+    }
+#endif
+    scan_report_count_on_air();
+#if (REPORT_DEFERRED_PROCESSING == 1)
+
+#if (REPORT_FAST_LANE == 1)
+    // The target device is connected to right away, its report skips the queued backlog.
+    // A report in a pool buffer is copied out and the uncommitted slot is reused.
+    if (target_match(p_adv_report))
+    {
+        target_connect(p_adv_report, m_evt_timestamp, CONNECT_LANE_FAST);
+        report_enqueue(&m_fast_ring, m_fast_slots, p_adv_report, m_evt_timestamp);
+    }
+    else
+#endif
+    {
+        // Under overload lower classes are shed first. The target check is only paid for a
+        // report about to be shed; with the fast lane targets never get here.
+        report_class_t report_class = (report_class_t)m_class_map[REPORT_CLASS_HASH(p_adv_report->peer_addr.addr)];
+
+        m_class_stats[report_class].reports++;
+        if ((report_ring_count(&m_report_ring) >= m_class_quota[report_class])
+#if (REPORT_FAST_LANE == 0)
+            && !target_match(p_adv_report)
+#endif
+        )
+        {
+            // A report in a pool buffer is left uncommitted, the slot is reused.
+            m_class_stats[report_class].shed++;
+        }
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+        else if ((m_scan_buffer.p_data != NULL) && (p_adv_report->data.p_data == m_scan_buffer.p_data))
+        {
+            report_commit_in_place(p_adv_report, m_evt_timestamp);
+        }
+#endif
+        else
+        {
+            report_enqueue(&m_report_ring, m_report_slots, p_adv_report, m_evt_timestamp);
+        }
+#if (REPORT_SCAN_BUFFER_POOL == 1)
+        resumed = scan_buffer_rotate();
+        waited = !resumed && (report_ring_count(&m_report_ring) > m_report_ring.mask);
+        resume_ts = timestamp_get();
+#endif
+    }
+#else
+    report_process(p_adv_report, m_evt_timestamp, true);
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+    report_batch_flush();
+#endif
+#endif
+
+    if (!resumed)
+    {
+#if (SCAN_DIRECT == 1)
+        if (!m_scan_stopped)
+        {
+            UNUSED_RETURN_VALUE(sd_ble_gap_scan_start(NULL, &m_scan_data_buffer));
+        }
+#endif
+        // Otherwise nrf_ble_scan resumes the scan right after this handler.
+        resume_ts = timestamp_get();
+    }
+
+    uint32_t cycles = DWT->CYCCNT - m_evt_cycles;
+    uint32_t pause = resume_ts - m_evt_timestamp;
+    m_handler_stats.pause_us += pause;
+    if (waited)
+    {
+        m_handler_stats.waits++;
+        m_handler_stats.wait_us += pause;
+    }
+    m_handler_stats.count++;
+    if (p_adv_report->primary_phy == BLE_GAP_PHY_CODED)
+    {
+        m_handler_stats.coded++;
+    }
+#if (SCAN_WHILE_CONNECTED == 1)
+    if (m_conn_scan.active)
+    {
+        m_handler_stats.connected++;
+    }
+#endif
+    channel_stats_count(p_adv_report);
+    m_handler_stats.cycles_total += cycles;
+    if (cycles > m_handler_stats.cycles_max)
+    {
+        m_handler_stats.cycles_max = cycles;
+    }
+}
+
+#if (SCAN_DIRECT == 0)
+/**@brief Function for handling scanning module events, in SoftDevice interrupt context.
+ */
+static void scan_evt_handler(scan_evt_t const *p_scan_evt)
+{
+    if (p_scan_evt->scan_evt_id == NRF_BLE_SCAN_EVT_SCAN_TIMEOUT)
+    {
+        scan_timeout_post();
+        return;
+    }
+    if (p_scan_evt->scan_evt_id == NRF_BLE_SCAN_EVT_WHITELIST_REQUEST)
+    {
+        // The whitelist is already set, see scan_radio_start().
+        return;
+    }
+#if (SCAN_TARGET_FILTER == 1)
+    if (p_scan_evt->scan_evt_id == NRF_BLE_SCAN_EVT_CONNECTING_ERROR)
+    {
+        // Reported before the filter match it belongs to.
+        m_filter_connect_err = p_scan_evt->params.connecting_err.err_code;
+        return;
+    }
+    if (p_scan_evt->scan_evt_id == NRF_BLE_SCAN_EVT_FILTER_MATCH)
+    {
+        target_connect(p_scan_evt->params.filter_match.p_adv_report, m_evt_timestamp, CONNECT_LANE_FILTER);
+        m_filter_connect_err = NRF_SUCCESS;
+        m_filter_connect_duty = scan_duty_permille(&m_scan_param);
+    }
+#endif
+
+    // Not found, whitelist report and filter match all carry the report first.
+    scan_report_handle(p_scan_evt->params.filter_match.p_adv_report);
+}
+
+/**@brief Function for initialization scanning and setting filters.
+ */
+static void scan_init(void)
+{
+    ret_code_t err_code;
+    nrf_ble_scan_init_t init_scan;
+    memset(&init_scan, 0, sizeof(init_scan));
+
+    init_scan.p_scan_param = &m_scan_param;
+    init_scan.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
+#if (SCAN_TARGET_FILTER == 1)
+    // The module connects with its copy of the scan parameters and these connection parameters,
+    // whatever the scan profile.
+    init_scan.connect_if_match = true;
+    init_scan.p_conn_param = &m_conn_param;
+#else
+    init_scan.connect_if_match = false;
+#endif
+
+    err_code = nrf_ble_scan_init(&m_scan, &init_scan, scan_evt_handler);
+    APP_ERROR_CHECK(err_code);
+#if (SCAN_TARGET_FILTER == 1)
+    err_code = nrf_ble_scan_filter_set(&m_scan, SCAN_NAME_FILTER, TARGET_DEVICE_NAME);
+    APP_ERROR_CHECK(err_code);
+    err_code = nrf_ble_scan_filters_enable(&m_scan, NRF_BLE_SCAN_NAME_FILTER, false);
+    APP_ERROR_CHECK(err_code);
+#endif
+}
+#endif
+
+/**@brief Function for logging and resetting the statistics, in the main loop.
+ */
+static void stats_log(void *p_event_data, uint16_t event_size)
+{
+    handler_stats_t handler_stats;
+
+    CRITICAL_REGION_ENTER();
+    handler_stats = m_handler_stats;
+    memset(&m_handler_stats, 0, sizeof(m_handler_stats));
+    CRITICAL_REGION_EXIT();
+
+    NRF_LOG_INFO(SCAN_PATH_NAME " scanner: %u reports, avg %u cycles, max %u cycles (%u us)",
+                 handler_stats.count,
+                 (handler_stats.count > 0) ? handler_stats.cycles_total / handler_stats.count : 0,
+                 handler_stats.cycles_max,
+                 handler_stats.cycles_max / CPU_CYCLES_PER_US);
+    NRF_LOG_INFO("reports per phy: %u 1M, %u coded",
+                 handler_stats.count - handler_stats.coded, handler_stats.coded);
+    channel_stats_log();
+    NRF_LOG_INFO("scan paused: %u us, %u us of it in %u waits for a free buffer",
+                 handler_stats.pause_us, handler_stats.wait_us, handler_stats.waits);
+#if (REPORT_DEFERRED_PROCESSING == 1)
+    NRF_LOG_INFO("report ring: %u overflows, high water %u of %u",
+                 m_report_ring.overflows, m_report_ring.high_water, REPORT_RING_SIZE);
+#if (REPORT_FAST_LANE == 1)
+    NRF_LOG_INFO("fast ring: %u overflows, high water %u of %u",
+                 m_fast_ring.overflows, m_fast_ring.high_water, REPORT_FAST_RING_SIZE);
+#endif
+
+    char histogram_string[(REPORT_BATCH_MAX + 1) * 12] = {0};
+    char *pos = histogram_string;
+    for (int i = 0; i <= REPORT_BATCH_MAX; i++)
+    {
+        pos += sprintf(pos, " %d:%u", i, (unsigned)m_batch_histogram[i]);
+        m_batch_histogram[i] = 0;
+    }
+    NRF_LOG_INFO("batch sizes per wakeup:%s", nrf_log_push(histogram_string));
+
+    static char const * const class_names[REPORT_CLASS_COUNT] = {"unknown", "known", "tracked", "target"};
+    class_stats_t class_stats[REPORT_CLASS_COUNT];
+    char class_string[REPORT_CLASS_COUNT * 32] = {0};
+
+    CRITICAL_REGION_ENTER();
+    memcpy(class_stats, m_class_stats, sizeof(class_stats));
+    memset(m_class_stats, 0, sizeof(m_class_stats));
+    CRITICAL_REGION_EXIT();
+
+    pos = class_string;
+    for (int i = 0; i < REPORT_CLASS_COUNT; i++)
+    {
+        pos += sprintf(pos, " %s %u/%u", class_names[i], (unsigned)class_stats[i].reports, (unsigned)class_stats[i].shed);
+    }
+    NRF_LOG_INFO("reports/shed per class:%s", nrf_log_push(class_string));
+#endif
+
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+    NRF_LOG_INFO("polling: %u iterations, %u events, %u at the budget of %u",
+                 m_poll_stats.iterations, m_poll_stats.events, m_poll_stats.saturated, POLL_EVT_BUDGET);
+    memset(&m_poll_stats, 0, sizeof(m_poll_stats));
+#endif
+
+    conn_sm_stats_t sm_stats;
+    char sm_string[CONN_STATE_COUNT * 32] = {0};
+    char *p_sm = sm_string;
+
+    conn_sm_stats_get(&sm_stats);
+    for (int i = CONN_STATE_IDLE; i < CONN_STATE_COUNT; i++)
+    {
+        p_sm += sprintf(p_sm, " %s %u/%u", conn_sm_state_name((conn_state_t)i), (unsigned)sm_stats.entries[i], (unsigned)sm_stats.time_ms[i]);
+    }
+    NRF_LOG_INFO("conn sm %s, entries/ms per state:%s",
+                 conn_sm_state_name(conn_sm_state_get()), nrf_log_push(sm_string));
+
+    NRF_LOG_INFO("cpu wakeups: %u/s, %u reports/s",
+                 m_wakeups / (STATS_INTERVAL_MS / 1000), handler_stats.count / (STATS_INTERVAL_MS / 1000));
+    m_wakeups = 0;
+#if (RSSI_GATE == 1)
+    uint32_t rssi_rejected;
+
+    CRITICAL_REGION_ENTER();
+    rssi_rejected = m_rssi_rejected;
+    m_rssi_rejected = 0;
+    CRITICAL_REGION_EXIT();
+    NRF_LOG_INFO("rssi gate: %u of %u reports below the floor, floors %d/%d dBm, %u devices %d dB lower",
+                 rssi_rejected, rssi_rejected + handler_stats.count,
+                 m_rssi_floor[DEVICE_CLASS_OTHER], m_rssi_floor[DEVICE_CLASS_TARGET],
+                 m_rssi_admitted, RSSI_HYSTERESIS);
+#endif
+#if (REPORT_OUTPUT_MODE == REPORT_OUTPUT_RTT)
+    report_rtt_stats_t rtt_stats;
+
+    report_rtt_stats_get(&rtt_stats);
+    NRF_LOG_INFO("rtt: %u writes, %u frames, %u bytes, dropped %u frames, %u bytes",
+                 rtt_stats.writes, rtt_stats.frames, rtt_stats.bytes,
+                 rtt_stats.dropped_frames, rtt_stats.dropped_bytes);
+#endif
+    NRF_LOG_INFO("discovered: %u devices in %u s, dictionary %d of %u, %u evicted",
+                 m_discovered, STATS_INTERVAL_MS / 1000, address_list_length, MAX_ADDRESS_COUNT, m_evicted);
+    m_discovered = 0;
+    m_evicted = 0;
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+    NRF_LOG_INFO("selective active scanning: active %u of %u s, now %s",
+                 m_scan_rsp_active_s, STATS_INTERVAL_MS / 1000, m_scan_rsp_wanted ? "active" : "passive");
+    m_scan_rsp_active_s = 0;
+#endif
+#if (SCAN_WHITELIST == 1)
+    NRF_LOG_INFO("whitelist: %u targets in the current slice, %u whitelist / %u learning slices",
+                 m_whitelist_len, m_whitelist_filtered, m_whitelist_learning);
+    m_whitelist_filtered = 0;
+    m_whitelist_learning = 0;
+#endif
+    NRF_LOG_INFO("scan profile %s: %u switches, %u scan restarts, longest %u us",
+                 m_scan_profile->p_name,
+                 m_scan_profile_stats.switches,
+                 m_scan_profile_stats.restarts,
+                 m_scan_profile_stats.restart_us_max);
+    memset(&m_scan_profile_stats, 0, sizeof(m_scan_profile_stats));
+#if (SCAN_ADAPTIVE == 1)
+    char duty_string[SCAN_DUTY_LEVELS * 16] = {0};
+    char *p_duty = duty_string;
+
+    for (int i = 0; i < SCAN_DUTY_LEVELS; i++)
+    {
+        p_duty += sprintf(p_duty, " %d:%u", i, (unsigned)m_scan_ctrl_level_ticks[i]);
+        m_scan_ctrl_level_ticks[i] = 0;
+    }
+    NRF_LOG_INFO("scan duty level %u, %u reports/s, ticks per level:%s",
+                 m_scan_ctrl.level, m_scan_ctrl.rate, nrf_log_push(duty_string));
+#endif
+
+#if (SCAN_WHILE_CONNECTED == 1)
+    conn_scan_account();
+    NRF_LOG_INFO("scan while connected: %u ms, ~%u ms of it left to connection events, %u reports",
+                 m_conn_scan.scan_us / 1000, m_conn_scan.lost_us / 1000, handler_stats.connected);
+    NRF_LOG_INFO("scan while connected: %u starts, %u connection intervals too short to scan in",
+                 m_conn_scan.starts, m_conn_scan.skipped);
+    CRITICAL_REGION_ENTER();
+    m_conn_scan.scan_us = 0;
+    m_conn_scan.lost_us = 0;
+    m_conn_scan.starts = 0;
+    m_conn_scan.skipped = 0;
+    CRITICAL_REGION_EXIT();
+#endif
+
+#if (SCAN_CONTINUOUS == 0)
+    NRF_LOG_INFO("scan restarts: %u, radio off %u us, ~%u reports lost",
+                 m_scan_gap.restarts, m_scan_gap.gap_us, m_scan_gap.lost_reports);
+#endif
+
+    static char const * const lane_names[CONNECT_LANE_COUNT] = {"fast", "bulk", "filter"};
+    connect_stats_t connect_stats[CONNECT_LANE_COUNT];
+
+    CRITICAL_REGION_ENTER();
+    memcpy(connect_stats, m_connect_stats, sizeof(connect_stats));
+    CRITICAL_REGION_EXIT();
+
+    for (int i = 0; i < CONNECT_LANE_COUNT; i++)
+    {
+        if (connect_stats[i].count > 0)
+        {
+            NRF_LOG_INFO("%s lane connects: %u, report to call avg %u us, max %u us, initiator duty avg %u permille",
+                         lane_names[i],
+                         connect_stats[i].count,
+                         connect_stats[i].latency_total_us / connect_stats[i].count,
+                         connect_stats[i].latency_max_us,
+                         connect_stats[i].duty_total / connect_stats[i].count);
+        }
+        if (connect_stats[i].connected > 0)
+        {
+            NRF_LOG_INFO("%s lane connections: %u, report to connected avg %u us, max %u us",
+                         lane_names[i],
+                         connect_stats[i].connected,
+                         connect_stats[i].connected_total_us / connect_stats[i].connected,
+                         connect_stats[i].connected_max_us);
+        }
+    }
+}
+
+static void stats_timeout_handler(void *p_context)
+{
+    // Keeps the RTC timestamp extension within one RTC counter period.
+    UNUSED_RETURN_VALUE(timestamp_get());
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, stats_log));
 }
 
-static void scan_evt_handler(scan_evt_t const *p_scan_evt)
+/**@brief Function for checking whether the scan runs between the connection events of a link.
+ */
+static bool scan_connected(void)
 {
-    if (p_scan_evt->scan_evt_id == NRF_BLE_SCAN_EVT_SCAN_TIMEOUT)
+#if (SCAN_WHILE_CONNECTED == 1)
+    return m_conn_scan.active;
+#else
+    return false;
+#endif
+}
+
+/**@brief Function for setting the scan parameters from the profile and a duty level,
+ *        restarting the scan if it is running.
+ *
+ * @details The SoftDevice only takes new parameters on a scan start, so a running scan is stopped
+ *          and started again right away; the radio is off only for the time between the two
+ *          calls.
+ */
+static void scan_params_apply(uint8_t level)
+{
+    scan_profile_t const *p_profile = m_scan_profile;
+    conn_state_t state;
+    uint32_t restart_us = 0;
+    bool restarted = false;
+
+    // In a critical region so a target report cannot move the state machine to connecting
+    // between the check and the restart.
+    CRITICAL_REGION_ENTER();
+    m_scan_level = level;
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+    m_scan_param.active = p_profile->active && m_scan_rsp_wanted;
+#else
+    m_scan_param.active = p_profile->active;
+#endif
+    m_scan_param.scan_phys = p_profile->scan_phys;
+    m_scan_param.extended = (p_profile->scan_phys != BLE_GAP_PHY_1MBPS);
+    m_scan_param.timeout = SCAN_TIMEOUT;
+    if (level == 0)
+    {
+        m_scan_param.interval = p_profile->duty.interval;
+        m_scan_param.window = p_profile->duty.window;
+    }
+    else
+    {
+        m_scan_param.interval = m_scan_duty[level - 1].interval;
+        m_scan_param.window = m_scan_duty[level - 1].window / scan_phy_count(p_profile->scan_phys);
+    }
+#if (SCAN_WHILE_CONNECTED == 1)
+    if (m_conn_scan.active)
+    {
+        // Between the connection events at any duty level. Without a timeout: the state machine
+        // restarts the scan only in the scanning states.
+        m_scan_param.interval = m_conn_scan.interval;
+        m_scan_param.window = m_conn_scan.window / scan_phy_count(p_profile->scan_phys);
+        m_scan_param.timeout = BLE_GAP_SCAN_TIMEOUT_UNLIMITED;
+    }
+#endif
+    state = conn_sm_state_get();
+    if ((state == CONN_STATE_SCANNING) || (state == CONN_STATE_RECONNECTING) || scan_connected())
+    {
+        uint32_t start_ts = timestamp_get();
+
+        scan_radio_start();
+        restart_us = timestamp_get() - start_ts;
+        restarted = true;
+    }
+    CRITICAL_REGION_EXIT();
+
+    if (restarted)
+    {
+        m_scan_profile_stats.restarts++;
+        m_scan_profile_stats.restart_us_max = MAX(m_scan_profile_stats.restart_us_max, restart_us);
+    }
+}
+
+#if (SCAN_WHILE_CONNECTED == 1)
+/**@brief Function for adding the time scanned while connected since the last call to the
+ *        statistics.
+ *
+ * @details The part of every scan interval outside the window is counted as lost to the
+ *          connection event.
+ */
+static void conn_scan_account(void)
+{
+    CRITICAL_REGION_ENTER();
+    if (m_conn_scan.active)
+    {
+        uint32_t now = timestamp_get();
+        uint32_t elapsed = now - m_conn_scan.start_ts;
+
+        m_conn_scan.start_ts = now;
+        m_conn_scan.scan_us += elapsed;
+        m_conn_scan.lost_us += (uint32_t)(((uint64_t)elapsed * (m_conn_scan.interval - m_conn_scan.window)) /
+                                          m_conn_scan.interval);
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+/**@brief Function for scanning between the connection events of a new link, or of a link whose
+ *        connection interval changed.
+ *
+ * @details The scan interval is the connection interval and the window what the connection
+ *          event, NRF_SDH_BLE_GAP_EVENT_LENGTH, leaves of it less SCAN_CONN_GUARD. Scan and
+ *          connection events then keep their phase: once the scheduler has placed the window
+ *          between two connection events, neither takes radio time from the other. A longer
+ *          window would be cut by every connection event, a shorter interval would let windows
+ *          collide with them.
+ *
+ *          No scan runs on a connection interval too short for the minimum window.
+ *
+ * @param[in] conn_interval Connection interval, in 1.25 ms units.
+ */
+static void conn_scan_start(uint16_t conn_interval)
+{
+    uint32_t interval = (uint32_t)conn_interval * 2; // In 0.625 ms units.
+    uint32_t reserved = (uint32_t)NRF_SDH_BLE_GAP_EVENT_LENGTH * 2 + SCAN_CONN_GUARD;
+
+    if (interval < reserved + BLE_GAP_SCAN_WINDOW_MIN * scan_phy_count(m_scan_profile->scan_phys))
     {
-        NRF_LOG_INFO("/****  Scan timed out ****/");
-        scan_start();
+        m_conn_scan.skipped++;
+        NRF_LOG_INFO("connection interval %u too short to scan in", conn_interval);
+        conn_scan_stop();
+        scan_stop();
         return;
     }
 
-    if (address_list_contains(p_scan_evt->params.filter_match.p_adv_report->peer_addr.addr) != false)
+    conn_scan_account();
+    CRITICAL_REGION_ENTER();
+    if (!m_conn_scan.active)
+    {
+        m_conn_scan.active = true;
+        m_conn_scan.start_ts = timestamp_get();
+    }
+    m_conn_scan.interval = (uint16_t)interval;
+    m_conn_scan.window = (uint16_t)(interval - reserved);
+    m_conn_scan.starts++;
+    CRITICAL_REGION_EXIT();
+#if (SCAN_TARGET_FILTER == 1)
+    // A filter match would stop the scan to connect, with no link left to connect on.
+    APP_ERROR_CHECK(nrf_ble_scan_filters_disable(&m_scan));
+#endif
+    scan_params_apply(m_scan_level);
+    NRF_LOG_INFO("scanning while connected: interval %u, window %u",
+                 m_scan_param.interval, m_scan_param.window);
+}
+
+/**@brief Function for going back to the parameters of the scanning states when the link is lost.
+ *
+ * @details The scan keeps running until the state machine restarts it with them.
+ */
+static void conn_scan_stop(void)
+{
+    if (!m_conn_scan.active)
+    {
         return;
+    }
+    conn_scan_account();
+    m_conn_scan.active = false;
+#if (SCAN_TARGET_FILTER == 1)
+    APP_ERROR_CHECK(nrf_ble_scan_filters_enable(&m_scan, NRF_BLE_SCAN_NAME_FILTER, false));
+#endif
+    scan_params_apply(m_scan_level);
+}
+#endif
 
-    address_list_add(p_scan_evt->params.filter_match.p_adv_report->peer_addr.addr);
+#if (SCAN_WHITELIST == 1)
+/**@brief Function for moving the whitelist on to the next slice of targets, in the main loop.
+ *
+ * @details Up to BLE_GAP_WHITELIST_ADDR_MAX_COUNT targets are taken from the dictionary, going
+ *          round from where the previous slice ended. Every @ref WHITELIST_LEARN_EVERY slices, and
+ *          as long as no target is known, the scan accepts all devices instead. Targets with a
+ *          resolvable or non-resolvable private address are left out: the SoftDevice only takes
+ *          identity addresses in a whitelist. The scan is only restarted when the policy or the
+ *          whitelist changes.
+ */
+static void whitelist_rotate(void *p_event_data, uint16_t event_size)
+{
+    ble_gap_addr_t addrs[BLE_GAP_WHITELIST_ADDR_MAX_COUNT];
+    uint8_t len = 0;
+    uint8_t filter_policy;
+    int length = address_list_length;
+    int next = m_whitelist_cursor;
 
-    /*switch (p_scan_evt->params.filter_match.p_adv_report->peer_addr.addr_type) {
-        case BLE_GAP_ADDR_TYPE_PUBLIC:
-            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_PUBLIC");
-            break;
-        case BLE_GAP_ADDR_TYPE_RANDOM_STATIC:
-            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_STATIC");
-            break;
-        case BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_RESOLVABLE:
-            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_RESOLVABLE");
-            break;
-        case BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_NON_RESOLVABLE:
-            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_RANDOM_PRIVATE_NON_RESOLVABLE");
-            break;
-        case BLE_GAP_ADDR_TYPE_ANONYMOUS:
-            NRF_LOG_INFO("address type BLE_GAP_ADDR_TYPE_ANONYMOUS");
-            break;
-    }*/
-    NRF_LOG_INFO("    ");
-    NRF_LOG_INFO("    ");
-    print_address(p_scan_evt->params.filter_match.p_adv_report);
-    char name[DEV_NAME_LEN] = {0};
-    print_name(p_scan_evt->params.filter_match.p_adv_report, name);
-    NRF_LOG_INFO("rssi: %d", p_scan_evt->params.filter_match.p_adv_report->rssi);
-    print_manufacturer_data(p_scan_evt->params.filter_match.p_adv_report);
-    NRF_LOG_INFO("    ");
-    NRF_LOG_INFO("    ");
+    if ((m_whitelist_slices++ % WHITELIST_LEARN_EVERY) != (WHITELIST_LEARN_EVERY - 1))
+    {
+        for (int i = 0; (i < length) && (len < BLE_GAP_WHITELIST_ADDR_MAX_COUNT); i++)
+        {
+            int index = (m_whitelist_cursor + i) % length;
 
-    // If device is found
-    if (strcmp(name, "AW050 DefaultSerialNumber!") == 0) // AW050 DefaultSerialNumber! //DeviceToTest
+            if ((address_list[index].device_class == DEVICE_CLASS_TARGET) &&
+                ((address_list[index].addr_type == BLE_GAP_ADDR_TYPE_PUBLIC) ||
+                 (address_list[index].addr_type == BLE_GAP_ADDR_TYPE_RANDOM_STATIC)))
+            {
+                addrs[len].addr_id_peer = 0;
+                addrs[len].addr_type = address_list[index].addr_type;
+                memcpy(addrs[len].addr, address_list[index].addr, BLE_GAP_ADDR_LEN);
+                len++;
+                next = index + 1;
+            }
+        }
+    }
+    filter_policy = (len > 0) ? BLE_GAP_SCAN_FP_WHITELIST : BLE_GAP_SCAN_FP_ACCEPT_ALL;
+    if (len > 0)
     {
-        NRF_LOG_INFO("--Device Found--");
-        nrf_ble_scan_stop();
-        NRF_LOG_INFO("--Scanning stopped--");
-        print_name(p_scan_evt->params.filter_match.p_adv_report, name);
-        print_address(p_scan_evt->params.filter_match.p_adv_report);
-        print_manufacturer_data(p_scan_evt->params.filter_match.p_adv_report);
-        // Connect Now
-        nrf_gpio_pin_set(29);
-        ret_code_t err_code = sd_ble_gap_connect(&p_scan_evt->params.filter_match.p_adv_report->peer_addr,
-                                                 &m_scan_param,
-                                                 &m_conn_param,
-                                                 APP_BLE_CONN_CFG_TAG);
+        m_whitelist_filtered++;
+    }
+    else
+    {
+        m_whitelist_learning++;
+    }
+
+    if ((filter_policy == m_scan_param.filter_policy) &&
+        (len == m_whitelist_len) &&
+        (memcmp(addrs, m_whitelist_addrs, len * sizeof(addrs[0])) == 0))
+    {
+        return;
+    }
+
+    CRITICAL_REGION_ENTER();
+    memcpy(m_whitelist_addrs, addrs, len * sizeof(addrs[0]));
+    for (uint8_t i = 0; i < len; i++)
+    {
+        m_whitelist_ptrs[i] = &m_whitelist_addrs[i];
+    }
+    m_whitelist_len = len;
+    m_whitelist_cursor = (uint8_t)((length > 0) ? next % length : 0);
+    m_scan_param.filter_policy = filter_policy;
+    CRITICAL_REGION_EXIT();
+    scan_params_apply(m_scan_level);
+}
+
+static void whitelist_timeout_handler(void *p_context)
+{
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, whitelist_rotate));
+}
+#endif
 
-        if (err_code != NRF_SUCCESS)
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+/**@brief Function for choosing between active and passive scanning, once a second in the main
+ *        loop.
+ *
+ * @details A device seen in the last SCAN_RSP_STALE_S seconds wants its scan response when it
+ *          has none yet or the last one is SCAN_RSP_STALE_S old. It is requested for
+ *          SCAN_RSP_RETRY_S seconds, then the device backs off as if it had answered. The scan
+ *          is active while any device wants a response, and restarted only when that changes.
+ */
+static void scan_rsp_check(void *p_event_data, uint16_t event_size)
+{
+    bool wanted = false;
+    uint16_t tick = ++m_scan_rsp_tick;
+
+    for (int i = 0; i < address_list_length; i++)
+    {
+        address_entry_t *p_entry = &address_list[i];
+        uint16_t age = tick - p_entry->rsp_tick;
+
+        if ((p_entry->scan_rsp == SCAN_RSP_NONE) || ((uint16_t)(tick - p_entry->seen_tick) >= SCAN_RSP_STALE_S))
         {
-            NRF_LOG_ERROR("sd_ble_gap_connect() failed: 0x%x.\r\n", err_code);
+            continue;
         }
-        else
-            NRF_LOG_ERROR("sd_ble_gap_connect() !!: 0x%x.\r\n", err_code);
+        if ((p_entry->scan_rsp == SCAN_RSP_RECEIVED) && (age >= SCAN_RSP_STALE_S))
+        {
+            p_entry->scan_rsp = SCAN_RSP_MISSING;
+            p_entry->rsp_tick = tick;
+        }
+        else if ((p_entry->scan_rsp == SCAN_RSP_MISSING) && (age >= SCAN_RSP_RETRY_S))
+        {
+            p_entry->scan_rsp = SCAN_RSP_RECEIVED;
+            p_entry->rsp_tick = tick;
+        }
+        wanted |= (p_entry->scan_rsp == SCAN_RSP_MISSING);
+    }
+
+    if (m_scan_rsp_wanted)
+    {
+        m_scan_rsp_active_s++;
+    }
+    if (wanted != m_scan_rsp_wanted)
+    {
+        m_scan_rsp_wanted = wanted;
+        scan_params_apply(m_scan_level);
     }
 }
 
-/**@brief Function for initialization scanning and setting filters.
+static void scan_rsp_timeout_handler(void *p_context)
+{
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, scan_rsp_check));
+}
+#endif
+
+#if (RSSI_GATE == 1)
+/**@brief Function for giving devices without a report above their lowered RSSI floor for
+ *        RSSI_HOLD_MS their full floor again, in the main loop.
  */
-static void scan_init(void)
+static void rssi_floor_check(void *p_event_data, uint16_t event_size)
 {
-    ret_code_t err_code;
-    nrf_ble_scan_init_t init_scan;
-    memset(&init_scan, 0, sizeof(init_scan));
+    uint32_t now = timestamp_get();
+    bool changed = false;
 
-    init_scan.p_scan_param = &m_scan_param;
-    init_scan.connect_if_match = false;
-    init_scan.conn_cfg_tag = APP_BLE_CONN_CFG_TAG;
+    for (int i = 0; i < address_list_length; i++)
+    {
+        address_entry_t *p_entry = &address_list[i];
 
-    err_code = nrf_ble_scan_init(&m_scan, &init_scan, scan_evt_handler);
+        if (p_entry->rssi_admitted && (now - p_entry->rssi_ts >= RSSI_HOLD_MS * 1000UL))
+        {
+            p_entry->rssi_admitted = false;
+            changed = true;
+        }
+    }
+    if (changed)
+    {
+        rssi_floor_map_build();
+    }
+}
+
+static void rssi_timeout_handler(void *p_context)
+{
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, rssi_floor_check));
+}
+#endif
+
+/**@brief Function for finding a scan profile by name.
+ *
+ * @return Profile index, or -1 if there is no profile of that name.
+ */
+static int scan_profile_find(char const *p_name)
+{
+    for (int i = 0; i < SCAN_PROFILE_COUNT; i++)
+    {
+        if (strcmp(m_scan_profiles[i].p_name, p_name) == 0)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+#if (SCAN_ADAPTIVE == 1)
+static void scan_ctrl_setup(void);
+#endif
+
+/**@brief Function for switching the scan profile, in the main loop.
+ *
+ * @details The duty controller restarts at the new profile's full duty. Cheap enough to be done
+ *          every second: one scan stop and start if scanning, nothing otherwise.
+ */
+static ret_code_t scan_profile_set(uint8_t profile)
+{
+    if (profile >= SCAN_PROFILE_COUNT)
+    {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    m_scan_profile = &m_scan_profiles[profile];
+    timestamp_source_set(m_scan_profile->rtc_timestamps);
+#if (SCAN_ADAPTIVE == 1)
+    scan_ctrl_setup();
+#endif
+    scan_params_apply(0);
+    m_scan_profile_stats.switches++;
+    NRF_LOG_INFO("scan profile %s: %s, interval %u, window %u",
+                 m_scan_profile->p_name,
+                 m_scan_param.active ? "active" : "passive",
+                 m_scan_param.interval,
+                 m_scan_param.window);
+
+    return NRF_SUCCESS;
+}
+
+#if (SCAN_ADAPTIVE == 1)
+/**@brief Function for running one controller tick on the reports and new devices since the
+ *        last one, in the main loop.
+ *
+ * @details Ticks only count while scanning. In any other state the controller goes back to full
+ *          duty, so the scan after a connection or a disconnect starts at full duty.
+ */
+static void scan_ctrl_update(void *p_event_data, uint16_t event_size)
+{
+    uint32_t reports;
+    uint32_t new_devices;
+    conn_state_t state = conn_sm_state_get();
+    uint8_t level = m_scan_ctrl.level;
+
+    CRITICAL_REGION_ENTER();
+    reports = m_scan_ctrl_reports;
+    new_devices = m_scan_ctrl_new_devices;
+    m_scan_ctrl_reports = 0;
+    m_scan_ctrl_new_devices = 0;
+    CRITICAL_REGION_EXIT();
+
+    if (!m_scan_profile->adaptive)
+    {
+        return;
+    }
+    if ((state != CONN_STATE_SCANNING) && (state != CONN_STATE_RECONNECTING))
+    {
+        if (level != 0)
+        {
+            scan_ctrl_init(&m_scan_ctrl, &m_scan_ctrl.config);
+            scan_params_apply(0);
+        }
+        return;
+    }
+
+    m_scan_ctrl_level_ticks[level]++;
+    if (scan_ctrl_tick(&m_scan_ctrl, reports, new_devices) != level)
+    {
+        level = m_scan_ctrl.level;
+        scan_params_apply(level);
+        NRF_LOG_INFO("scan duty level %u: interval %u, window %u, %u reports/s, %u new devices",
+                     level, m_scan_param.interval, m_scan_param.window, m_scan_ctrl.rate, new_devices);
+    }
+}
+
+static void scan_ctrl_timeout_handler(void *p_context)
+{
+    UNUSED_RETURN_VALUE(app_sched_event_put(NULL, 0, scan_ctrl_update));
+}
+
+/**@brief Function for initializing the scan duty controller at the profile's full duty.
+ */
+static void scan_ctrl_setup(void)
+{
+    static uint16_t duty_permille[SCAN_DUTY_LEVELS];
+    scan_ctrl_config_t config = {
+        .p_duty_permille = duty_permille,
+        .levels = SCAN_DUTY_LEVELS,
+        .tick_ms = SCAN_CTRL_DEFAULT_TICK_MS,
+        .quiet_rate = SCAN_CTRL_DEFAULT_QUIET_RATE,
+        .wake_devices = SCAN_CTRL_DEFAULT_WAKE_DEVICES,
+        .backoff_ticks = SCAN_CTRL_DEFAULT_BACKOFF_TICKS,
+    };
+
+    duty_permille[0] = (uint16_t)MIN(1000, (1000UL * scan_phy_count(m_scan_profile->scan_phys) * m_scan_profile->duty.window) /
+                                               m_scan_profile->duty.interval);
+    for (int i = 1; i < SCAN_DUTY_LEVELS; i++)
+    {
+        duty_permille[i] = (uint16_t)((1000UL * m_scan_duty[i - 1].window) / m_scan_duty[i - 1].interval);
+    }
+    scan_ctrl_init(&m_scan_ctrl, &config);
+}
+#endif
+
+#if (SCAN_CONTINUOUS == 1)
+/**@brief Function for rolling the dedup window on by one bucket, without touching the scan.
+ */
+static void dedup_timeout_handler(void *p_context)
+{
+    m_dedup_bucket++;
+}
+#endif
+
+/**@brief Function for matching a command word at the start of a command line.
+ *
+ * @param[in]  p_line  Command line.
+ * @param[in]  p_cmd   Command word.
+ * @param[out] pp_args Arguments after the word, an empty string if there are none.
+ *
+ * @return True if the line starts with the word followed by a space or the end of the line.
+ */
+static bool uart_cmd_match(char const *p_line, char const *p_cmd, char const **pp_args)
+{
+    size_t len = strlen(p_cmd);
+
+    if ((strncmp(p_line, p_cmd, len) != 0) || ((p_line[len] != ' ') && (p_line[len] != '\0')))
+    {
+        return false;
+    }
+    *pp_args = (p_line[len] == ' ') ? &p_line[len + 1] : &p_line[len];
+    return true;
+}
+
+/**@brief Function for handling the "profile" command.
+ */
+static void uart_cmd_profile(char const *p_args)
+{
+    int profile = (*p_args != '\0') ? scan_profile_find(p_args) : -1;
+
+    if (profile < 0)
+    {
+        NRF_LOG_INFO("scan profile %s, available:", m_scan_profile->p_name);
+        for (int i = 0; i < SCAN_PROFILE_COUNT; i++)
+        {
+            NRF_LOG_INFO("  %s", m_scan_profiles[i].p_name);
+        }
+        return;
+    }
+    APP_ERROR_CHECK(scan_profile_set((uint8_t)profile));
+}
+
+#if (RSSI_GATE == 1)
+/**@brief Function for handling the "rssi" command.
+ */
+static void uart_cmd_rssi(char const *p_args)
+{
+    device_class_t device_class = DEVICE_CLASS_OTHER;
+    char const *p_target;
+    char *p_end;
+    long floor;
+
+    if (uart_cmd_match(p_args, "target", &p_target))
+    {
+        device_class = DEVICE_CLASS_TARGET;
+        p_args = p_target;
+    }
+    floor = strtol(p_args, &p_end, 10);
+    if ((p_end == p_args) || (*p_end != '\0') || (floor < INT8_MIN) || (floor > 0))
+    {
+        NRF_LOG_INFO("rssi floors: %d dBm, targets %d dBm; rssi [target] <dBm>",
+                     m_rssi_floor[DEVICE_CLASS_OTHER], m_rssi_floor[DEVICE_CLASS_TARGET]);
+        return;
+    }
+    m_rssi_floor[device_class] = (int8_t)floor;
+    rssi_floor_map_build();
+    NRF_LOG_INFO("rssi floor of %s set to %d dBm",
+                 (device_class == DEVICE_CLASS_TARGET) ? "targets" : "other devices", (int)floor);
+}
+#endif
+
+/**@brief Function for handling a command line received on the command UART, in the main loop.
+ *
+ * @details "profile <name>" switches the scan profile, "profile" lists them. With RSSI_GATE
+ *          "rssi <dBm>" and "rssi target <dBm>" set the RSSI floors, "rssi" shows them.
+ */
+static void uart_cmd_handle(char const *p_line)
+{
+    char const *p_args;
+
+    if (uart_cmd_match(p_line, "profile", &p_args))
+    {
+        uart_cmd_profile(p_args);
+    }
+#if (RSSI_GATE == 1)
+    else if (uart_cmd_match(p_line, "rssi", &p_args))
+    {
+        uart_cmd_rssi(p_args);
+    }
+#endif
+    else
+    {
+        NRF_LOG_WARNING("unknown command: %s", nrf_log_push((char *)p_line));
+    }
+}
+
+/**@brief Function for initializing the timer module and the statistics timer.
+ */
+static void timers_init(void)
+{
+    ret_code_t err_code = app_timer_init();
+    APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&m_stats_timer_id, APP_TIMER_MODE_REPEATED, stats_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#if (SCAN_CONTINUOUS == 1)
+    err_code = app_timer_create(&m_dedup_timer_id, APP_TIMER_MODE_REPEATED, dedup_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+    err_code = app_timer_create(&m_scan_rsp_timer_id, APP_TIMER_MODE_REPEATED, scan_rsp_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_WHITELIST == 1)
+    err_code = app_timer_create(&m_whitelist_timer_id, APP_TIMER_MODE_REPEATED, whitelist_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_ADAPTIVE == 1)
+    err_code = app_timer_create(&m_scan_ctrl_timer_id, APP_TIMER_MODE_REPEATED, scan_ctrl_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (RSSI_GATE == 1)
+    err_code = app_timer_create(&m_rssi_timer_id, APP_TIMER_MODE_REPEATED, rssi_timeout_handler);
     APP_ERROR_CHECK(err_code);
+#endif
+#if (REPORT_DEFERRED_PROCESSING == 1)
+    err_code = app_timer_create(&m_class_timer_id, APP_TIMER_MODE_REPEATED, class_timeout_handler);
+    APP_ERROR_CHECK(err_code);
+#endif
+}
+
+/**@brief Function for enabling the DWT cycle counter used to measure handler run times.
+ */
+static void cycle_counter_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 int main(void)
@@ -307,9 +3103,23 @@ int main(void)
     err_code = NRF_LOG_INIT(NULL);
     APP_ERROR_CHECK(err_code);
     NRF_LOG_DEFAULT_BACKENDS_INIT();
+    timestamp_init();
+    cycle_counter_init();
+    timers_init();
+    APP_SCHED_INIT(SCHED_MAX_EVENT_DATA_SIZE, SCHED_QUEUE_SIZE);
 
     ble_stack_init();
+#if (SCAN_DIRECT == 0)
     scan_init();
+#endif
+#if (REPORT_OUTPUT_MODE == REPORT_OUTPUT_RTT)
+    report_rtt_init();
+#endif
+#if (REPORT_OUTPUT_MODE != REPORT_OUTPUT_TEXT)
+    report_codec_init(&m_report_codec);
+    report_sync_output();
+    report_batch_flush();
+#endif
 
 
     
@@ -317,15 +3127,76 @@ int main(void)
     // Start execution.
     NRF_LOG_INFO("------------------------------------------");
     NRF_LOG_INFO("--------------Start scan------------------");
-    scan_start();
+    conn_sm_init_t sm_init = {
+        .scan_start = scan_start,
+        .connect = sm_connect,
+        .connect_cancel = sm_connect_cancel,
+        .discover = sm_discover,
+        .disconnect = sm_disconnect,
+        .timestamp_get = timestamp_get,
+    };
+    conn_sm_evt_t sm_evt = {.type = CONN_SM_EVT_START};
+    conn_sm_init(&sm_init);
+#if (RSSI_GATE == 1)
+    rssi_floor_map_build();
+#endif
+    APP_ERROR_CHECK(scan_profile_set(SCAN_PROFILE_DEFAULT));
+    conn_sm_evt_put(&sm_evt);
+    APP_ERROR_CHECK(uart_cmd_init(uart_cmd_handle));
+    err_code = app_timer_start(m_stats_timer_id, STATS_INTERVAL, NULL);
+    APP_ERROR_CHECK(err_code);
+#if (SCAN_CONTINUOUS == 1)
+    err_code = app_timer_start(m_dedup_timer_id, APP_TIMER_TICKS(DEDUP_BUCKET_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_ACTIVE_SELECTIVE == 1)
+    err_code = app_timer_start(m_scan_rsp_timer_id, APP_TIMER_TICKS(SCAN_RSP_CHECK_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_WHITELIST == 1)
+    err_code = app_timer_start(m_whitelist_timer_id, APP_TIMER_TICKS(WHITELIST_SLICE_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (SCAN_ADAPTIVE == 1)
+    err_code = app_timer_start(m_scan_ctrl_timer_id, APP_TIMER_TICKS(SCAN_CTRL_DEFAULT_TICK_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (RSSI_GATE == 1)
+    err_code = app_timer_start(m_rssi_timer_id, APP_TIMER_TICKS(RSSI_HOLD_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
+#if (REPORT_DEFERRED_PROCESSING == 1)
+    err_code = app_timer_start(m_class_timer_id, APP_TIMER_TICKS(REPORT_CLASS_AGE_MS), NULL);
+    APP_ERROR_CHECK(err_code);
+#endif
 
     // Enter main loop.
     for (;;)
     {
+        bool work_pending = false;
+
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+        work_pending |= sd_evts_poll(POLL_EVT_BUDGET);
+#endif
+        app_sched_execute();
+        scan_timeout_missed_process();
+#if (REPORT_DEFERRED_PROCESSING == 1)
+        work_pending |= report_queue_process();
+#endif
+#if (NRF_SDH_DISPATCH_MODEL == NRF_SDH_DISPATCH_MODEL_POLLING)
+        work_pending |= log_process(POLL_LOG_BUDGET);
+#else
         NRF_LOG_FLUSH();
+#endif
 
-        __WFI();
-        __SEV();
-        __WFE();
+        // Sleep only once all work is done. An interrupt since the last wait leaves the event
+        // register set, so the first WFE returns at once instead of missing that wakeup.
+        if (!work_pending)
+        {
+            __WFE();
+            __SEV();
+            __WFE();
+            m_wakeups++;
+        }
     }
-}
\ No newline at end of file
+}
@@ -0,0 +1,283 @@
+/**@file
+ *
+ * @brief Compact binary encoding of advertising reports.
+ *
+ * Frame layouts, multi-byte fields are little endian:
+ *   SYNC: type | ts (4)
+ *   DEV:  type | index | addr_type | addr (6) | rssi | zz(ts delta) | data_len | data [| phy]
+ *   RPT:  type | index | zz(rssi delta) | zz(ts delta) [| phy]
+ * where zz() is a zig-zag encoded LEB128 varint. phy is only present when the primary PHY differs
+ * from the device's previous report, a DEV frame starting from 1M. On the transport every frame is preceded by
+ * its length as an unsigned LEB128 varint.
+ */
+#include <string.h>
+#include "report_codec.h"
+
+static uint8_t * varint_put(uint8_t * p_out, int32_t value)
+{
+    uint32_t zz = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+
+    while (zz >= 0x80)
+    {
+        *p_out++ = (uint8_t)(zz | 0x80);
+        zz >>= 7;
+    }
+    *p_out++ = (uint8_t)zz;
+
+    return p_out;
+}
+
+static uint8_t const * varint_get(uint8_t const * p_in, uint8_t const * p_end, int32_t * p_value)
+{
+    uint32_t zz    = 0;
+    uint8_t  shift = 0;
+
+    while (p_in < p_end && shift < 35)
+    {
+        uint8_t byte = *p_in++;
+        zz |= (uint32_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            *p_value = (int32_t)(zz >> 1) ^ -(int32_t)(zz & 1);
+            return p_in;
+        }
+        shift += 7;
+    }
+
+    return NULL;
+}
+
+static uint8_t * ts_delta_put(report_codec_t * p_codec, uint8_t * p_out, uint32_t ts)
+{
+    p_out = varint_put(p_out, (int32_t)(ts - p_codec->last_ts));
+    p_codec->last_ts = ts;
+
+    return p_out;
+}
+
+void report_codec_init(report_codec_t * p_codec)
+{
+    memset(p_codec, 0, sizeof(*p_codec));
+}
+
+uint16_t report_encode_sync(report_codec_t * p_codec, uint32_t ts, uint8_t * p_out)
+{
+    p_out[0] = REPORT_FRAME_SYNC;
+    p_out[1] = (uint8_t)ts;
+    p_out[2] = (uint8_t)(ts >> 8);
+    p_out[3] = (uint8_t)(ts >> 16);
+    p_out[4] = (uint8_t)(ts >> 24);
+    p_codec->last_ts = ts;
+
+    return 5;
+}
+
+uint16_t report_encode_dev(report_codec_t * p_codec, report_rec_t const * p_rec, uint8_t * p_out)
+{
+    uint8_t * p_pos = p_out;
+
+    *p_pos++ = REPORT_FRAME_DEV;
+    *p_pos++ = p_rec->index;
+    *p_pos++ = p_rec->addr_type;
+    memcpy(p_pos, p_rec->addr, REPORT_CODEC_ADDR_LEN);
+    p_pos += REPORT_CODEC_ADDR_LEN;
+    *p_pos++ = (uint8_t)p_rec->rssi;
+    p_pos    = ts_delta_put(p_codec, p_pos, p_rec->ts);
+    *p_pos++ = p_rec->data_len;
+    memcpy(p_pos, p_rec->p_data, p_rec->data_len);
+    p_pos += p_rec->data_len;
+    if (p_rec->phy != REPORT_CODEC_PHY_1M)
+    {
+        *p_pos++ = p_rec->phy;
+    }
+
+    if (p_rec->index != REPORT_CODEC_INDEX_NONE)
+    {
+        p_codec->last_rssi[p_rec->index] = p_rec->rssi;
+        p_codec->last_phy[p_rec->index]  = p_rec->phy;
+    }
+
+    return (uint16_t)(p_pos - p_out);
+}
+
+uint16_t report_encode_rpt(report_codec_t * p_codec, report_rec_t const * p_rec, uint8_t * p_out)
+{
+    uint8_t * p_pos = p_out;
+
+    *p_pos++ = REPORT_FRAME_RPT;
+    *p_pos++ = p_rec->index;
+    p_pos    = varint_put(p_pos, p_rec->rssi - p_codec->last_rssi[p_rec->index]);
+    p_pos    = ts_delta_put(p_codec, p_pos, p_rec->ts);
+    if (p_rec->phy != p_codec->last_phy[p_rec->index])
+    {
+        *p_pos++ = p_rec->phy;
+    }
+
+    p_codec->last_rssi[p_rec->index] = p_rec->rssi;
+    p_codec->last_phy[p_rec->index]  = p_rec->phy;
+
+    return (uint16_t)(p_pos - p_out);
+}
+
+uint16_t report_record_put(uint8_t * p_out, uint8_t const * p_frame, uint16_t len)
+{
+    uint16_t prefix_len = 0;
+    uint16_t value      = len;
+
+    while (value >= 0x80)
+    {
+        p_out[prefix_len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    p_out[prefix_len++] = (uint8_t)value;
+    memcpy(&p_out[prefix_len], p_frame, len);
+
+    return prefix_len + len;
+}
+
+bool report_record_get(uint8_t const ** pp_in,
+                       uint8_t const *  p_end,
+                       uint8_t const ** pp_frame,
+                       uint16_t *       p_len)
+{
+    uint8_t const * p_pos = *pp_in;
+    uint32_t        len   = 0;
+    uint8_t         shift = 0;
+    uint8_t         byte;
+
+    do
+    {
+        if (p_pos >= p_end || shift > 7)
+        {
+            return false;
+        }
+        byte   = *p_pos++;
+        len   |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    if (len > REPORT_CODEC_FRAME_MAX || (uint32_t)(p_end - p_pos) < len)
+    {
+        return false;
+    }
+
+    *pp_frame = p_pos;
+    *p_len    = (uint16_t)len;
+    *pp_in    = p_pos + len;
+
+    return true;
+}
+
+void report_decoder_init(report_decoder_t * p_dec)
+{
+    memset(p_dec, 0, sizeof(*p_dec));
+}
+
+bool report_decode(report_decoder_t * p_dec,
+                   uint8_t const    * p_frame,
+                   uint16_t           len,
+                   uint8_t          * p_type,
+                   report_rec_t     * p_rec)
+{
+    uint8_t const * p_pos = p_frame;
+    uint8_t const * p_end = p_frame + len;
+    int32_t         delta;
+
+    if (len < 1)
+    {
+        return false;
+    }
+
+    memset(p_rec, 0, sizeof(*p_rec));
+    *p_type = *p_pos++;
+
+    switch (*p_type)
+    {
+        case REPORT_FRAME_SYNC:
+            if (len != 5)
+            {
+                return false;
+            }
+            p_dec->codec.last_ts = (uint32_t)p_pos[0]
+                                 | ((uint32_t)p_pos[1] << 8)
+                                 | ((uint32_t)p_pos[2] << 16)
+                                 | ((uint32_t)p_pos[3] << 24);
+            p_dec->synced = true;
+            p_rec->ts     = p_dec->codec.last_ts;
+            return true;
+
+        case REPORT_FRAME_DEV:
+            if (len < 3 + REPORT_CODEC_ADDR_LEN + 1)
+            {
+                return false;
+            }
+            p_rec->index     = *p_pos++;
+            p_rec->addr_type = *p_pos++;
+            memcpy(p_rec->addr, p_pos, REPORT_CODEC_ADDR_LEN);
+            p_pos      += REPORT_CODEC_ADDR_LEN;
+            p_rec->rssi = (int8_t)*p_pos++;
+            p_pos       = varint_get(p_pos, p_end, &delta);
+            if (p_pos == NULL || p_pos >= p_end ||
+                (p_end - (p_pos + 1) != *p_pos && p_end - (p_pos + 1) != *p_pos + 1))
+            {
+                return false;
+            }
+            p_rec->data_len = *p_pos++;
+            p_rec->p_data   = p_pos;
+            p_rec->phy      = (p_end - p_pos > p_rec->data_len) ? p_pos[p_rec->data_len] : REPORT_CODEC_PHY_1M;
+
+            p_dec->codec.last_ts += (uint32_t)delta;
+            p_rec->ts             = p_dec->codec.last_ts;
+
+            if (p_rec->index != REPORT_CODEC_INDEX_NONE)
+            {
+                p_dec->codec.last_rssi[p_rec->index] = p_rec->rssi;
+                p_dec->codec.last_phy[p_rec->index]  = p_rec->phy;
+                p_dec->addr_type[p_rec->index]       = p_rec->addr_type;
+                memcpy(p_dec->addr[p_rec->index], p_rec->addr, REPORT_CODEC_ADDR_LEN);
+                p_dec->known[p_rec->index] = true;
+            }
+            return true;
+
+        case REPORT_FRAME_RPT:
+            if (len < 4)
+            {
+                return false;
+            }
+            p_rec->index = *p_pos++;
+            if (p_rec->index == REPORT_CODEC_INDEX_NONE)
+            {
+                return false;
+            }
+            p_pos = varint_get(p_pos, p_end, &delta);
+            if (p_pos == NULL)
+            {
+                return false;
+            }
+            p_rec->rssi = (int8_t)(p_dec->codec.last_rssi[p_rec->index] + delta);
+            p_dec->codec.last_rssi[p_rec->index] = p_rec->rssi;
+
+            p_pos = varint_get(p_pos, p_end, &delta);
+            if (p_pos == NULL || p_end - p_pos > 1)
+            {
+                return false;
+            }
+            if (p_pos < p_end)
+            {
+                p_dec->codec.last_phy[p_rec->index] = *p_pos;
+            }
+            p_rec->phy = p_dec->codec.last_phy[p_rec->index];
+            p_dec->codec.last_ts += (uint32_t)delta;
+            p_rec->ts             = p_dec->codec.last_ts;
+
+            if (p_dec->known[p_rec->index])
+            {
+                p_rec->addr_type = p_dec->addr_type[p_rec->index];
+                memcpy(p_rec->addr, p_dec->addr[p_rec->index], REPORT_CODEC_ADDR_LEN);
+            }
+            return true;
+
+        default:
+            return false;
+    }
+}
@@ -0,0 +1,149 @@
+/**@file
+ *
+ * @brief Compact binary encoding of advertising reports.
+ *
+ * @details Devices are identified by their index in the scanner's address dictionary. The first
+ *          report of a device after a dictionary resync is sent as a @ref REPORT_FRAME_DEV frame
+ *          carrying the full address and the advertising data, later reports are sent as
+ *          @ref REPORT_FRAME_RPT frames carrying only the index, the RSSI change since the
+ *          previous report of the same device and the time elapsed since the previous frame.
+ *          Both deltas are zig-zag varint encoded, so a report of a known device takes 4 to 6
+ *          bytes. The primary PHY is only sent when it differs from the device's previous report.
+ *
+ *          The module has no SDK dependencies so that the same code is used by the firmware to
+ *          encode and by the host tools to decode the stream.
+ */
+#ifndef REPORT_CODEC_H__
+#define REPORT_CODEC_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORT_CODEC_ADDR_LEN    6    /**< Length of a device address. */
+#define REPORT_CODEC_MAX_DEVICES 255  /**< Number of dictionary indexes. */
+#define REPORT_CODEC_INDEX_NONE  0xFF /**< Index of a device that is not in the dictionary. */
+#define REPORT_CODEC_DATA_MAX    255  /**< Maximum length of the advertising data in a frame. */
+#define REPORT_CODEC_PHY_1M      0x01 /**< LE 1M primary PHY, as BLE_GAP_PHY_1MBPS. */
+#define REPORT_CODEC_PHY_CODED   0x04 /**< LE Coded primary PHY, as BLE_GAP_PHY_CODED. */
+
+/**@brief Maximum length of an encoded frame. */
+#define REPORT_CODEC_FRAME_MAX (1 + 1 + 1 + REPORT_CODEC_ADDR_LEN + 1 + 5 + 1 + REPORT_CODEC_DATA_MAX + 1)
+
+/**@brief Maximum length of a record: a frame preceded by its length as an unsigned varint. */
+#define REPORT_CODEC_RECORD_MAX (2 + REPORT_CODEC_FRAME_MAX)
+
+/**@brief Frame types. */
+typedef enum
+{
+    REPORT_FRAME_SYNC = 0x01, /**< Absolute timestamp. Restarts the timestamp delta chain. */
+    REPORT_FRAME_DEV  = 0x02, /**< Dictionary entry: index, address, absolute RSSI and advertising data. */
+    REPORT_FRAME_RPT  = 0x03, /**< Report of a device announced earlier: index and RSSI delta. */
+} report_frame_type_t;
+
+/**@brief Decoded form of a report. */
+typedef struct
+{
+    uint32_t        ts;                            /**< Timestamp in microseconds. */
+    uint8_t         index;                         /**< Dictionary index or @ref REPORT_CODEC_INDEX_NONE. */
+    uint8_t         addr_type;                     /**< Address type, as in ble_gap_addr_t. */
+    uint8_t         addr[REPORT_CODEC_ADDR_LEN];   /**< Device address, least significant byte first. */
+    int8_t          rssi;                          /**< RSSI in dBm. */
+    uint8_t         phy;                           /**< Primary PHY, @ref REPORT_CODEC_PHY_1M or @ref REPORT_CODEC_PHY_CODED. */
+    uint8_t         data_len;                      /**< Length of the advertising data. */
+    uint8_t const * p_data;                        /**< Advertising data. Only used by @ref REPORT_FRAME_DEV. */
+} report_rec_t;
+
+/**@brief Delta state shared by the encoder and the decoder. */
+typedef struct
+{
+    uint32_t last_ts;                              /**< Timestamp of the previous frame. */
+    int8_t   last_rssi[REPORT_CODEC_MAX_DEVICES];  /**< RSSI of the previous report, per index. */
+    uint8_t  last_phy[REPORT_CODEC_MAX_DEVICES];   /**< Primary PHY of the previous report, per index. */
+} report_codec_t;
+
+/**@brief Decoder state. */
+typedef struct
+{
+    report_codec_t codec;                                              /**< Delta state. */
+    uint8_t        addr_type[REPORT_CODEC_MAX_DEVICES];                /**< Address types, per index. */
+    uint8_t        addr[REPORT_CODEC_MAX_DEVICES][REPORT_CODEC_ADDR_LEN]; /**< Addresses, per index. */
+    bool           known[REPORT_CODEC_MAX_DEVICES];                    /**< Index has been announced. */
+    bool           synced;                                             /**< A SYNC frame has been received. */
+} report_decoder_t;
+
+/**@brief Function for resetting the encoder or decoder delta state. */
+void report_codec_init(report_codec_t * p_codec);
+
+/**@brief Function for encoding a SYNC frame.
+ *
+ * @param[in]  p_codec Encoder state.
+ * @param[in]  ts      Current timestamp in microseconds.
+ * @param[out] p_out   Output buffer of at least @ref REPORT_CODEC_FRAME_MAX bytes.
+ *
+ * @return Length of the frame.
+ */
+uint16_t report_encode_sync(report_codec_t * p_codec, uint32_t ts, uint8_t * p_out);
+
+/**@brief Function for encoding a DEV frame announcing @p p_rec->index. */
+uint16_t report_encode_dev(report_codec_t * p_codec, report_rec_t const * p_rec, uint8_t * p_out);
+
+/**@brief Function for encoding a RPT frame for a device announced earlier. */
+uint16_t report_encode_rpt(report_codec_t * p_codec, report_rec_t const * p_rec, uint8_t * p_out);
+
+/**@brief Function for writing a frame as a record, preceded by its length.
+ *
+ * @details Records are what goes over the transport. Several records may be written back to back.
+ *
+ * @param[out] p_out   Output buffer of at least len + 2 bytes.
+ * @param[in]  p_frame Frame.
+ * @param[in]  len     Frame length.
+ *
+ * @return Length of the record.
+ */
+uint16_t report_record_put(uint8_t * p_out, uint8_t const * p_frame, uint16_t len);
+
+/**@brief Function for reading one record.
+ *
+ * @param[in,out] pp_in    Read position, advanced past the record.
+ * @param[in]     p_end    End of the input.
+ * @param[out]    pp_frame Frame inside the input.
+ * @param[out]    p_len    Frame length.
+ *
+ * @retval true  A complete record was read.
+ * @retval false The input is exhausted or ends in a partial record.
+ */
+bool report_record_get(uint8_t const ** pp_in,
+                       uint8_t const *  p_end,
+                       uint8_t const ** pp_frame,
+                       uint16_t *       p_len);
+
+/**@brief Function for resetting the decoder. */
+void report_decoder_init(report_decoder_t * p_dec);
+
+/**@brief Function for decoding one frame.
+ *
+ * @param[in]  p_dec   Decoder state.
+ * @param[in]  p_frame Frame.
+ * @param[in]  len     Frame length.
+ * @param[out] p_type  Frame type.
+ * @param[out] p_rec   Decoded report. @p p_rec->p_data points into @p p_frame.
+ *
+ * @retval true  The frame was decoded. A RPT frame of an index that has not been announced yet
+ *               (see @ref report_decoder_t::known) has no address and no meaningful RSSI.
+ * @retval false The frame is malformed.
+ */
+bool report_decode(report_decoder_t * p_dec,
+                   uint8_t const    * p_frame,
+                   uint16_t           len,
+                   uint8_t          * p_type,
+                   report_rec_t     * p_rec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPORT_CODEC_H__
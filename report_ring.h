@@ -0,0 +1,162 @@
+/**@file
+ *
+ * @brief Lock-free single-producer/single-consumer ring of report slots.
+ *
+ * @details The ring only manages slot indexes; the slots themselves are an array owned by the
+ *          user, with @ref REPORT_RING_DEF's size. The producer (an interrupt handler) and the
+ *          consumer (the main loop) each own one free-running counter, so neither side blocks or
+ *          disables interrupts. Slots are filled and read in place:
+ *
+ *          Producer: @ref report_ring_write_slot, fill the slot, @ref report_ring_commit.
+ *          Consumer: @ref report_ring_read_slot, process the slot, @ref report_ring_release.
+ *
+ *          The data memory barriers order the slot contents against the counter updates, as
+ *          required on Cortex-M4 when the counters are used as the only synchronization.
+ */
+#ifndef REPORT_RING_H__
+#define REPORT_RING_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef REPORT_RING_HOST
+// Host builds, e.g. tools/report_ring_stress.c: threads instead of an interrupt handler.
+#define REPORT_RING_BARRIER() __atomic_thread_fence(__ATOMIC_SEQ_CST) /**< Full memory barrier. */
+#ifndef __STATIC_INLINE
+#define __STATIC_INLINE static inline
+#endif
+#ifndef STATIC_ASSERT
+#define STATIC_ASSERT(_cond) _Static_assert(_cond, #_cond)
+#endif
+#else
+#include "nrf.h"
+#include "app_util.h"
+
+#define REPORT_RING_BARRIER() __DMB() /**< Data memory barrier. */
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**@brief Ring control block. */
+typedef struct
+{
+    volatile uint32_t head;       /**< Slots committed. Written by the producer only. */
+    volatile uint32_t tail;       /**< Slots released. Written by the consumer only. */
+    uint32_t          mask;       /**< Number of slots minus one. */
+    uint32_t          overflows;  /**< Slots the producer could not get. Written by the producer only. */
+    uint32_t          high_water; /**< Highest fill level seen. Written by the producer only. */
+} report_ring_t;
+
+/**@brief Macro for defining a ring control block.
+ *
+ * @param _name Name of the control block.
+ * @param _size Number of slots. Must be a power of two.
+ */
+#define REPORT_RING_DEF(_name, _size)                                              \
+    STATIC_ASSERT(((_size) & ((_size) - 1)) == 0 && (_size) > 0);                  \
+    static report_ring_t _name = {.mask = (_size) - 1}
+
+/**@brief Function for getting the number of committed, unreleased slots. */
+__STATIC_INLINE uint32_t report_ring_count(report_ring_t const * p_ring)
+{
+    return p_ring->head - p_ring->tail;
+}
+
+/**@brief Function for getting the slot the producer writes next, without counting an overflow.
+ *
+ * @details Used to hand a slot's memory out ahead of the write, e.g. as a DMA or SoftDevice
+ *          buffer. The slot stays the next one until it is committed.
+ *
+ * @param[in]  p_ring  Ring.
+ * @param[out] p_index Index of the free slot.
+ *
+ * @retval true  A slot is free.
+ * @retval false The ring is full.
+ */
+__STATIC_INLINE bool report_ring_free_slot(report_ring_t * p_ring, uint32_t * p_index)
+{
+    uint32_t head = p_ring->head;
+
+    if (head - p_ring->tail > p_ring->mask)
+    {
+        return false;
+    }
+    // The consumer is done with the slot before the tail moves past it.
+    REPORT_RING_BARRIER();
+    *p_index = head & p_ring->mask;
+
+    return true;
+}
+
+/**@brief Function for getting the slot the producer writes next.
+ *
+ * @param[in]  p_ring  Ring.
+ * @param[out] p_index Index of the free slot.
+ *
+ * @retval true  A slot is free.
+ * @retval false The ring is full. The overflow counter is incremented.
+ */
+__STATIC_INLINE bool report_ring_write_slot(report_ring_t * p_ring, uint32_t * p_index)
+{
+    if (!report_ring_free_slot(p_ring, p_index))
+    {
+        p_ring->overflows++;
+        return false;
+    }
+
+    return true;
+}
+
+/**@brief Function for handing the slot from @ref report_ring_write_slot to the consumer. */
+__STATIC_INLINE void report_ring_commit(report_ring_t * p_ring)
+{
+    uint32_t head = p_ring->head + 1;
+    uint32_t used = head - p_ring->tail;
+
+    if (used > p_ring->high_water)
+    {
+        p_ring->high_water = used;
+    }
+    // Slot contents must be visible before the slot is published.
+    REPORT_RING_BARRIER();
+    p_ring->head = head;
+}
+
+/**@brief Function for getting the oldest committed slot.
+ *
+ * @param[in]  p_ring  Ring.
+ * @param[out] p_index Index of the slot.
+ *
+ * @retval true  A slot is available.
+ * @retval false The ring is empty.
+ */
+__STATIC_INLINE bool report_ring_read_slot(report_ring_t * p_ring, uint32_t * p_index)
+{
+    uint32_t tail = p_ring->tail;
+
+    if (p_ring->head == tail)
+    {
+        return false;
+    }
+    // Slot contents are read only after the head that published them.
+    REPORT_RING_BARRIER();
+    *p_index = tail & p_ring->mask;
+
+    return true;
+}
+
+/**@brief Function for returning the slot from @ref report_ring_read_slot to the producer. */
+__STATIC_INLINE void report_ring_release(report_ring_t * p_ring)
+{
+    // Reads of the slot must complete before the producer may reuse it.
+    REPORT_RING_BARRIER();
+    p_ring->tail = p_ring->tail + 1;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPORT_RING_H__
@@ -0,0 +1,41 @@
+/**@file
+ *
+ * @brief Binary report stream on a dedicated SEGGER RTT up-buffer.
+ */
+#include "sdk_common.h"
+#include "SEGGER_RTT.h"
+#include "report_rtt.h"
+
+static uint8_t            m_buffer[REPORT_RTT_BUFFER_SIZE]; /**< RTT up-buffer. */
+static report_rtt_stats_t m_stats;                          /**< Stream statistics. */
+
+void report_rtt_init(void)
+{
+    int err = SEGGER_RTT_ConfigUpBuffer(REPORT_RTT_CHANNEL,
+                                        "reports",
+                                        m_buffer,
+                                        sizeof(m_buffer),
+                                        SEGGER_RTT_MODE_NO_BLOCK_SKIP);
+    APP_ERROR_CHECK_BOOL(err >= 0);
+}
+
+bool report_rtt_write(uint8_t const * p_records, uint16_t len, uint16_t frames)
+{
+    // In skip mode the batch is written completely or not at all.
+    if (SEGGER_RTT_Write(REPORT_RTT_CHANNEL, p_records, len) == 0)
+    {
+        m_stats.dropped_frames += frames;
+        m_stats.dropped_bytes += len;
+        return false;
+    }
+
+    m_stats.frames += frames;
+    m_stats.bytes += len;
+    m_stats.writes++;
+    return true;
+}
+
+void report_rtt_stats_get(report_rtt_stats_t * p_stats)
+{
+    *p_stats = m_stats;
+}
@@ -0,0 +1,59 @@
+/**@file
+ *
+ * @brief Binary report stream on a dedicated SEGGER RTT up-buffer.
+ *
+ * @details Records (see @ref report_record_put) are written to their own RTT channel so that
+ *          the human-readable log keeps channel 0. The channel runs in "skip if full" mode: a
+ *          batch of records is written completely or not at all, and dropped frames are
+ *          counted.
+ */
+#ifndef REPORT_RTT_H__
+#define REPORT_RTT_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef REPORT_RTT_CHANNEL
+#define REPORT_RTT_CHANNEL 1        /**< RTT up-buffer index. Must be below SEGGER_RTT_CONFIG_MAX_NUM_UP_BUFFERS. */
+#endif
+
+#ifndef REPORT_RTT_BUFFER_SIZE
+#define REPORT_RTT_BUFFER_SIZE 4096 /**< Size of the up-buffer, independent of SEGGER_RTT_CONFIG_BUFFER_SIZE_UP. */
+#endif
+
+/**@brief Report stream statistics. */
+typedef struct
+{
+    uint32_t frames;         /**< Frames written. */
+    uint32_t bytes;          /**< Bytes written, including length prefixes. */
+    uint32_t writes;         /**< Batches written. */
+    uint32_t dropped_frames; /**< Frames dropped because the buffer was full. */
+    uint32_t dropped_bytes;  /**< Bytes dropped because the buffer was full. */
+} report_rtt_stats_t;
+
+/**@brief Function for configuring the RTT up-buffer. */
+void report_rtt_init(void);
+
+/**@brief Function for writing a batch of records to the RTT channel.
+ *
+ * @param[in] p_records Records.
+ * @param[in] len       Length of the records.
+ * @param[in] frames    Number of records, for the statistics.
+ *
+ * @retval true  The batch was written.
+ * @retval false The buffer did not have room for the whole batch and it was dropped.
+ */
+bool report_rtt_write(uint8_t const * p_records, uint16_t len, uint16_t frames);
+
+/**@brief Function for getting the stream statistics. */
+void report_rtt_stats_get(report_rtt_stats_t * p_stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REPORT_RTT_H__
@@ -0,0 +1,45 @@
+/**@file
+ *
+ * @brief Adaptive scan duty cycle controller.
+ */
+#include "scan_ctrl.h"
+
+void scan_ctrl_init(scan_ctrl_t * p_ctrl, scan_ctrl_config_t const * p_config)
+{
+    p_ctrl->config      = *p_config;
+    p_ctrl->level       = 0;
+    p_ctrl->quiet_ticks = 0;
+    p_ctrl->rate        = 0;
+}
+
+uint8_t scan_ctrl_tick(scan_ctrl_t * p_ctrl, uint32_t reports, uint32_t new_devices)
+{
+    scan_ctrl_config_t const * p_config = &p_ctrl->config;
+    uint32_t                   duty     = p_config->p_duty_permille[p_ctrl->level];
+    uint32_t                   rate;
+
+    // Reports per second had the radio been on all the time.
+    rate = (uint32_t)(((uint64_t)reports * 1000 * 1000) / ((uint64_t)duty * p_config->tick_ms));
+    p_ctrl->rate = (3 * p_ctrl->rate + rate) / 4;
+
+    if (new_devices >= p_config->wake_devices)
+    {
+        p_ctrl->level       = 0;
+        p_ctrl->quiet_ticks = 0;
+    }
+    else if (p_ctrl->rate < p_config->quiet_rate)
+    {
+        if ((++p_ctrl->quiet_ticks >= p_config->backoff_ticks) && (p_ctrl->level + 1 < p_config->levels))
+        {
+            p_ctrl->level++;
+            p_ctrl->quiet_ticks = 0;
+        }
+    }
+    else
+    {
+        // Busy with known devices: hold the level.
+        p_ctrl->quiet_ticks = 0;
+    }
+
+    return p_ctrl->level;
+}
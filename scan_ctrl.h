@@ -0,0 +1,79 @@
+/**@file
+ *
+ * @brief Adaptive scan duty cycle controller.
+ *
+ * @details Chooses one of a list of scan duty levels, level 0 being full duty, from the
+ *          reports and the new devices seen in each tick. The report rate is scaled by the
+ *          duty it was measured at, so it estimates how busy the area is independent of the
+ *          level. Quiet ticks step the duty down one level at a time; new devices return to
+ *          full duty at once.
+ *
+ *          The module has no SDK dependencies so that tools/scan_ctrl_replay.c can replay a
+ *          captured report stream through the same decisions on the host.
+ */
+#ifndef SCAN_CTRL_H__
+#define SCAN_CTRL_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCAN_CTRL_DEFAULT_TICK_MS       1000 /**< Default time between ticks. */
+#define SCAN_CTRL_DEFAULT_QUIET_RATE    20   /**< Default quiet report rate, in reports per second at full duty. */
+#define SCAN_CTRL_DEFAULT_WAKE_DEVICES  1    /**< Default number of new devices in a tick that return to full duty. */
+#define SCAN_CTRL_DEFAULT_BACKOFF_TICKS 10   /**< Default number of quiet ticks before stepping down one level. */
+
+#define SCAN_CTRL_DUTY_LEVELS 4 /**< Number of duty levels the firmware runs, level 0 being the full duty of the scan profile. */
+
+#define SCAN_CTRL_UNITS(MS) ((MS) * 1000 / 625) /**< Milliseconds to 0.625 ms scan units, as MSEC_TO_UNITS does. */
+
+/**@brief Initializer of the scan interval and window of the reduced duty levels, from level 1,
+ *        in 0.625 ms units. Shared by main.c and tools/scan_ctrl_replay.c.
+ */
+#define SCAN_CTRL_REDUCED_DUTY                               \
+    {                                                        \
+        {SCAN_CTRL_UNITS(100), SCAN_CTRL_UNITS(50)},         \
+        {SCAN_CTRL_UNITS(200), SCAN_CTRL_UNITS(30)},         \
+        {SCAN_CTRL_UNITS(1000), SCAN_CTRL_UNITS(30)},        \
+    }
+
+/**@brief Controller configuration. */
+typedef struct
+{
+    uint16_t const * p_duty_permille; /**< Radio duty of each level in 1/1000, level 0 first. */
+    uint8_t          levels;          /**< Number of levels. */
+    uint32_t         tick_ms;         /**< Time between calls to @ref scan_ctrl_tick. */
+    uint32_t         quiet_rate;      /**< Report rate, scaled to full duty, below which a tick is quiet. */
+    uint8_t          wake_devices;    /**< New devices in one tick that return to level 0. */
+    uint8_t          backoff_ticks;   /**< Consecutive quiet ticks before stepping down one level. */
+} scan_ctrl_config_t;
+
+/**@brief Controller state. */
+typedef struct
+{
+    scan_ctrl_config_t config;      /**< Configuration. */
+    uint8_t            level;       /**< Current level. */
+    uint8_t            quiet_ticks; /**< Consecutive quiet ticks at the current level. */
+    uint32_t           rate;        /**< Smoothed report rate, in reports per second at full duty. */
+} scan_ctrl_t;
+
+/**@brief Function for initializing a controller at full duty. */
+void scan_ctrl_init(scan_ctrl_t * p_ctrl, scan_ctrl_config_t const * p_config);
+
+/**@brief Function for feeding one tick of measurements to the controller.
+ *
+ * @param[in] p_ctrl      Controller.
+ * @param[in] reports     Reports received during the tick.
+ * @param[in] new_devices Devices seen for the first time during the tick.
+ *
+ * @return Level to scan at during the next tick.
+ */
+uint8_t scan_ctrl_tick(scan_ctrl_t * p_ctrl, uint32_t reports, uint32_t new_devices);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SCAN_CTRL_H__
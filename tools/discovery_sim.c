@@ -0,0 +1,514 @@
+/**@file
+ *
+ * @brief Host simulator of device discovery for sets of scan parameters.
+ *
+ * Models advertisers against the scanner's schedule and prints, per combination of parameters,
+ * how long devices take to be found and how complete each report window is. The combinations
+ * are the cross product of the parameter ranges and run in parallel on all cores.
+ *
+ * Advertisers: every advertising event sends one legacy PDU on 37, 38 and 39 in turn, a fixed
+ * hop apart. Events follow each other at the advertising interval plus a random advDelay of 0 to
+ * 10 ms; each device starts at a random phase.
+ *
+ * Scanner: one channel per scan window, 37, 38, 39 in turn, one window per scan interval, as the
+ * SoftDevice does. With a scan duration (SCAN_DURATION_WITELIST) the scan times out after it and
+ * is restarted on 37 after a gap; with duration 0 it runs continuously (SCAN_CONTINUOUS).
+ *
+ * A PDU is received if it lies entirely in a window on its channel and no other PDU on that
+ * channel overlaps it (a collision loses both), less a random loss rate. Time to discovery is
+ * counted from the scan start to the first PDU received from a device. The fraction found per
+ * window is the share of devices received at least once in each report window: the scan
+ * duration, or the dedup window when scanning continuously.
+ *
+ * Results are the same whatever the number of threads: every combination seeds its own random
+ * generator from its index.
+ *
+ * Options, ranges are "value" or "first:last:step":
+ *   -i scan interval, 0.625 ms units     -w scan window, 0.625 ms units (only up to the interval)
+ *   -d scan duration, s (0: continuous)  -a advertising interval, ms
+ *   -n advertisers in range              -t simulated time per run, s
+ *   -r runs per combination              -j threads (default: all cores)
+ *   -g restart gap, us                   -e dedup window when continuous, s
+ *   -p PDU air time, us                  -h PDU start to next channel's PDU start, us
+ *   -l random PDU loss, percent
+ *
+ * Prints one CSV line per combination, in the order of the ranges.
+ *
+ * Build: cc -O2 -pthread -o discovery_sim discovery_sim.c
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define ADV_CHANNELS    3     /* Primary advertising channels. */
+#define ADV_DELAY_US    10000 /* advDelay is drawn from 0 to this. */
+#define UNIT_US         625   /* Scan interval and window unit, in microseconds. */
+#define DEVICES_MAX     1024  /* Advertisers per run. */
+#define THREADS_MAX     256
+#define DEDUP_BUCKET_MS 10000 /* Dedup bucket with SCAN_CONTINUOUS, as in main.c. */
+#define DEDUP_BUCKETS   5     /* Buckets per dedup window, as in main.c. */
+
+/* Parameter range, first to last inclusive. */
+typedef struct
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t step;
+} range_t;
+
+/* One combination to simulate. */
+typedef struct
+{
+    uint32_t interval;    /* Scan interval, 0.625 ms units. */
+    uint32_t window;      /* Scan window, 0.625 ms units. */
+    uint32_t duration_s;  /* Scan duration, 0: continuous. */
+    uint32_t adv_ms;      /* Advertising interval. */
+    uint32_t devices;     /* Advertisers in range. */
+} combo_t;
+
+/* Results of one combination over all runs. */
+typedef struct
+{
+    uint32_t found;          /* Devices found, over all runs. */
+    uint32_t ttd_ms[4];      /* Time to discovery percentiles 50, 90, 99 and the maximum. */
+    double   window_found;   /* Mean fraction of devices found per report window. */
+    uint64_t collisions;     /* PDUs in a window lost to collisions. */
+} result_t;
+
+/* A PDU that overlaps a scan window on its channel. */
+typedef struct
+{
+    uint64_t ts;         /* Start of the PDU. */
+    uint16_t device;     /* Advertiser. */
+    bool     complete;   /* Lies entirely in the window. */
+} pdu_t;
+
+/* Settings common to all combinations. */
+typedef struct
+{
+    uint64_t sim_us;       /* Simulated time per run. */
+    uint32_t runs;         /* Runs per combination. */
+    uint32_t gap_us;       /* Radio off between a scan timeout and the restart. */
+    uint32_t dedup_s;      /* Report window when scanning continuously. */
+    uint32_t pdu_us;       /* PDU air time. */
+    uint32_t hop_us;       /* PDU start to the next channel's PDU start. */
+    uint32_t loss_permille; /* Random PDU loss. */
+} sim_config_t;
+
+/* Per thread buffers. */
+typedef struct
+{
+    pdu_t    * p_pdus;      /* PDUs overlapping a window. */
+    size_t     pdus_max;
+    uint64_t * p_ttd;       /* Time to discovery of every device found, over all runs. */
+    uint8_t  * p_seen;      /* Devices seen per report window. */
+    size_t     seen_max;
+} sim_buffers_t;
+
+static sim_config_t m_config =
+{
+    .sim_us        = 60 * 1000000ULL,
+    .runs          = 4,
+    .gap_us        = 1000,
+    .dedup_s       = DEDUP_BUCKETS * DEDUP_BUCKET_MS / 1000, /* 50 s. */
+    .pdu_us        = 376,  /* ADV_IND with 31 bytes of data on LE 1M. */
+    .hop_us        = 1000, /* Room for a scan request and response after each PDU. */
+    .loss_permille = 0,
+};
+
+static combo_t       * m_combos;
+static result_t      * m_results;
+static size_t          m_combo_count;
+static size_t          m_next_combo;
+static pthread_mutex_t m_next_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* xorshift64*, seeded per combination and run. */
+static uint64_t rand_next(uint64_t * p_state)
+{
+    uint64_t x = *p_state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *p_state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static uint32_t rand_below(uint64_t * p_state, uint32_t limit)
+{
+    return (uint32_t)((rand_next(p_state) >> 32) % limit);
+}
+
+/* Finds the scan window a time falls in. Returns false if the radio is not scanning then. */
+static bool window_at(combo_t const * p_combo, uint64_t ts, uint64_t * p_window, uint8_t * p_channel)
+{
+    uint64_t interval_us = (uint64_t)p_combo->interval * UNIT_US;
+    uint64_t window_us   = (uint64_t)p_combo->window * UNIT_US;
+    uint64_t run         = 0;
+    uint64_t offset      = ts;
+
+    if (p_combo->duration_s > 0)
+    {
+        uint64_t duration_us = p_combo->duration_s * 1000000ULL;
+
+        run    = ts / (duration_us + m_config.gap_us);
+        offset = ts - run * (duration_us + m_config.gap_us);
+        if (offset >= duration_us)
+        {
+            return false;
+        }
+    }
+
+    uint64_t index = offset / interval_us;
+
+    if (offset - index * interval_us >= window_us)
+    {
+        return false;
+    }
+    // Window numbers are unique over restarts; the channel starts on 37 with every restart.
+    *p_window  = (run << 32) | index;
+    *p_channel = (uint8_t)(index % ADV_CHANNELS);
+    return true;
+}
+
+static int pdu_compare(void const * p_a, void const * p_b)
+{
+    uint64_t a = ((pdu_t const *)p_a)->ts;
+    uint64_t b = ((pdu_t const *)p_b)->ts;
+
+    return (a > b) - (a < b);
+}
+
+static int u64_compare(void const * p_a, void const * p_b)
+{
+    uint64_t a = *(uint64_t const *)p_a;
+    uint64_t b = *(uint64_t const *)p_b;
+
+    return (a > b) - (a < b);
+}
+
+static void * buffer_grow(void * p_buffer, size_t * p_max, size_t needed, size_t size)
+{
+    if (needed <= *p_max)
+    {
+        return p_buffer;
+    }
+    *p_max   = needed * 2;
+    p_buffer = realloc(p_buffer, *p_max * size);
+    if (p_buffer == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p_buffer;
+}
+
+/* Simulates one run. Adds the time to discovery of the devices found to p_ttd and returns their
+ * number; the fraction found per report window is added to *p_window_found. */
+static uint32_t run_simulate(combo_t const * p_combo, uint64_t seed, sim_buffers_t * p_buf,
+                             uint64_t * p_ttd, double * p_window_found, uint64_t * p_collisions)
+{
+    uint64_t rng         = seed;
+    uint64_t adv_us      = p_combo->adv_ms * 1000ULL;
+    size_t   pdu_count   = 0;
+    uint64_t report_us   = (p_combo->duration_s > 0) ? p_combo->duration_s * 1000000ULL + m_config.gap_us
+                                                     : m_config.dedup_s * 1000000ULL;
+    size_t   windows     = (size_t)(m_config.sim_us / report_us);
+    uint64_t first_ts[DEVICES_MAX];
+
+    // PDUs of all advertisers that overlap a scan window on their channel.
+    for (uint32_t device = 0; device < p_combo->devices; device++)
+    {
+        uint64_t ts = rand_below(&rng, (uint32_t)adv_us);
+
+        while (ts < m_config.sim_us)
+        {
+            for (uint8_t channel = 0; channel < ADV_CHANNELS; channel++)
+            {
+                uint64_t start = ts + (uint64_t)channel * m_config.hop_us;
+                uint64_t end   = start + m_config.pdu_us - 1;
+                uint64_t start_window, end_window;
+                uint8_t  start_channel, end_channel;
+                bool     start_in = window_at(p_combo, start, &start_window, &start_channel) && (start_channel == channel);
+                bool     end_in   = window_at(p_combo, end, &end_window, &end_channel) && (end_channel == channel);
+
+                if (start_in || end_in)
+                {
+                    p_buf->p_pdus = buffer_grow(p_buf->p_pdus, &p_buf->pdus_max, pdu_count + 1, sizeof(pdu_t));
+                    p_buf->p_pdus[pdu_count++] = (pdu_t){
+                        .ts       = start,
+                        .device   = (uint16_t)device,
+                        .complete = start_in && end_in && (start_window == end_window),
+                    };
+                }
+            }
+            ts += adv_us + rand_below(&rng, ADV_DELAY_US + 1);
+        }
+    }
+    qsort(p_buf->p_pdus, pdu_count, sizeof(pdu_t), pdu_compare);
+
+    p_buf->p_seen = buffer_grow(p_buf->p_seen, &p_buf->seen_max, windows * p_combo->devices + 1, 1);
+    memset(p_buf->p_seen, 0, windows * p_combo->devices);
+    for (uint32_t device = 0; device < p_combo->devices; device++)
+    {
+        first_ts[device] = UINT64_MAX;
+    }
+
+    // All PDUs have the same air time: one overlapping any other overlaps a neighbour.
+    for (size_t i = 0; i < pdu_count; i++)
+    {
+        pdu_t const * p_pdu = &p_buf->p_pdus[i];
+        bool collided = ((i > 0) && (p_pdu->ts - p_buf->p_pdus[i - 1].ts < m_config.pdu_us)) ||
+                        ((i + 1 < pdu_count) && (p_buf->p_pdus[i + 1].ts - p_pdu->ts < m_config.pdu_us));
+
+        if (!p_pdu->complete)
+        {
+            continue;
+        }
+        if (collided)
+        {
+            (*p_collisions)++;
+            continue;
+        }
+        if ((m_config.loss_permille > 0) && (rand_below(&rng, 1000) < m_config.loss_permille))
+        {
+            continue;
+        }
+        if (first_ts[p_pdu->device] == UINT64_MAX)
+        {
+            first_ts[p_pdu->device] = p_pdu->ts + m_config.pdu_us;
+        }
+
+        size_t window = (size_t)(p_pdu->ts / report_us);
+
+        if (window < windows)
+        {
+            p_buf->p_seen[window * p_combo->devices + p_pdu->device] = 1;
+        }
+    }
+
+    uint32_t found = 0;
+
+    for (uint32_t device = 0; device < p_combo->devices; device++)
+    {
+        if (first_ts[device] != UINT64_MAX)
+        {
+            p_ttd[found++] = first_ts[device];
+        }
+    }
+    if (windows > 0)
+    {
+        size_t seen = 0;
+
+        for (size_t i = 0; i < windows * p_combo->devices; i++)
+        {
+            seen += p_buf->p_seen[i];
+        }
+        *p_window_found += (double)seen / ((double)windows * p_combo->devices);
+    }
+    return found;
+}
+
+static void combo_simulate(size_t index, sim_buffers_t * p_buf)
+{
+    combo_t const * p_combo = &m_combos[index];
+    result_t      * p_res   = &m_results[index];
+    double          window_found = 0;
+
+    p_buf->p_ttd = realloc(p_buf->p_ttd, (size_t)m_config.runs * p_combo->devices * sizeof(uint64_t));
+    if (p_buf->p_ttd == NULL)
+    {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(p_res, 0, sizeof(*p_res));
+
+    for (uint32_t run = 0; run < m_config.runs; run++)
+    {
+        uint64_t seed = ((uint64_t)index << 20) ^ run ^ 0x9E3779B97F4A7C15ULL;
+
+        p_res->found += run_simulate(p_combo, seed, p_buf, &p_buf->p_ttd[p_res->found],
+                                     &window_found, &p_res->collisions);
+    }
+    p_res->window_found = window_found / m_config.runs;
+
+    if (p_res->found > 0)
+    {
+        static uint32_t const permille[] = {500, 900, 990, 1000};
+
+        qsort(p_buf->p_ttd, p_res->found, sizeof(uint64_t), u64_compare);
+        for (int i = 0; i < 4; i++)
+        {
+            size_t rank = ((size_t)p_res->found * permille[i] + 999) / 1000;
+
+            p_res->ttd_ms[i] = (uint32_t)(p_buf->p_ttd[(rank > 0 ? rank : 1) - 1] / 1000);
+        }
+    }
+}
+
+static void * worker(void * p_context)
+{
+    sim_buffers_t buf = {0};
+
+    (void)p_context;
+    for (;;)
+    {
+        size_t index;
+
+        pthread_mutex_lock(&m_next_lock);
+        index = m_next_combo++;
+        pthread_mutex_unlock(&m_next_lock);
+        if (index >= m_combo_count)
+        {
+            break;
+        }
+        combo_simulate(index, &buf);
+    }
+    free(buf.p_pdus);
+    free(buf.p_ttd);
+    free(buf.p_seen);
+    return NULL;
+}
+
+static bool range_parse(char const * p_arg, range_t * p_range)
+{
+    unsigned first, last, step;
+    int      fields = sscanf(p_arg, "%u:%u:%u", &first, &last, &step);
+
+    if (fields == 1)
+    {
+        *p_range = (range_t){first, first, 1};
+        return true;
+    }
+    if ((fields == 3) && (step > 0) && (last >= first))
+    {
+        *p_range = (range_t){first, last, step};
+        return true;
+    }
+    return false;
+}
+
+static uint32_t range_count(range_t const * p_range)
+{
+    return (p_range->last - p_range->first) / p_range->step + 1;
+}
+
+int main(int argc, char ** argv)
+{
+    range_t   interval = {16, 1600, 16};   /* 10 ms to 1 s. */
+    range_t   window   = {16, 1600, 16};
+    range_t   duration = {0, 0, 1};
+    range_t   adv      = {100, 100, 1};
+    range_t   devices  = {20, 20, 1};
+    long      threads  = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t thread_ids[THREADS_MAX];
+    int       opt;
+    bool      ok = true;
+
+    while ((opt = getopt(argc, argv, "i:w:d:a:n:t:r:j:g:e:p:h:l:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': ok = range_parse(optarg, &interval); break;
+            case 'w': ok = range_parse(optarg, &window);   break;
+            case 'd': ok = range_parse(optarg, &duration); break;
+            case 'a': ok = range_parse(optarg, &adv);      break;
+            case 'n': ok = range_parse(optarg, &devices);  break;
+            case 't': m_config.sim_us        = strtoull(optarg, NULL, 0) * 1000000ULL; break;
+            case 'r': m_config.runs          = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'j': threads                = strtol(optarg, NULL, 0); break;
+            case 'g': m_config.gap_us        = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'e': m_config.dedup_s       = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'p': m_config.pdu_us        = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'h': m_config.hop_us        = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'l': m_config.loss_permille = (uint32_t)(strtod(optarg, NULL) * 10); break;
+            default:  ok = false; break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr,
+                    "usage: %s [-i interval] [-w window] [-d duration_s] [-a adv_ms] [-n devices]\n"
+                    "       [-t sim_s] [-r runs] [-j threads] [-g gap_us] [-e dedup_s] [-p pdu_us]\n"
+                    "       [-h hop_us] [-l loss_pct]    ranges: value or first:last:step\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((interval.first == 0) || (window.first == 0) || (adv.first == 0) || (devices.first == 0) ||
+        (devices.last > DEVICES_MAX) || (m_config.runs == 0) || (m_config.dedup_s == 0) ||
+        (m_config.pdu_us == 0) || (m_config.sim_us == 0))
+    {
+        fprintf(stderr, "interval, window, advertising interval, devices (up to %u), runs, dedup window, "
+                        "PDU time and simulated time must be non-zero\n", DEVICES_MAX);
+        return 1;
+    }
+    threads = (threads < 1) ? 1 : (threads > THREADS_MAX) ? THREADS_MAX : threads;
+
+    size_t max = (size_t)range_count(&interval) * range_count(&window) * range_count(&duration) *
+                 range_count(&adv) * range_count(&devices);
+
+    m_combos  = malloc(max * sizeof(combo_t));
+    m_results = malloc(max * sizeof(result_t));
+    if ((m_combos == NULL) || (m_results == NULL))
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (uint32_t i = interval.first; i <= interval.last; i += interval.step)
+    {
+        for (uint32_t w = window.first; (w <= window.last) && (w <= i); w += window.step)
+        {
+            for (uint32_t d = duration.first; d <= duration.last; d += duration.step)
+            {
+                for (uint32_t a = adv.first; a <= adv.last; a += adv.step)
+                {
+                    for (uint32_t n = devices.first; n <= devices.last; n += devices.step)
+                    {
+                        m_combos[m_combo_count++] = (combo_t){i, w, d, a, n};
+                    }
+                }
+            }
+        }
+    }
+    if (m_combo_count == 0)
+    {
+        fprintf(stderr, "no window fits an interval\n");
+        return 1;
+    }
+    fprintf(stderr, "%zu combinations, %u runs each, on %ld threads\n", m_combo_count, m_config.runs, threads);
+
+    for (long t = 0; t < threads; t++)
+    {
+        if (pthread_create(&thread_ids[t], NULL, worker, NULL) != 0)
+        {
+            fprintf(stderr, "cannot start thread %ld\n", t);
+            return 1;
+        }
+    }
+    for (long t = 0; t < threads; t++)
+    {
+        pthread_join(thread_ids[t], NULL);
+    }
+
+    printf("interval,window,duty_pct,duration_s,adv_ms,devices,found_pct,"
+           "ttd_p50_ms,ttd_p90_ms,ttd_p99_ms,ttd_max_ms,window_found_pct,collisions\n");
+    for (size_t i = 0; i < m_combo_count; i++)
+    {
+        combo_t const  * p_combo = &m_combos[i];
+        result_t const * p_res   = &m_results[i];
+
+        printf("%u,%u,%.1f,%u,%u,%u,%.1f,%u,%u,%u,%u,%.1f,%llu\n",
+               p_combo->interval, p_combo->window, 100.0 * p_combo->window / p_combo->interval,
+               p_combo->duration_s, p_combo->adv_ms, p_combo->devices,
+               100.0 * p_res->found / ((double)m_config.runs * p_combo->devices),
+               p_res->ttd_ms[0], p_res->ttd_ms[1], p_res->ttd_ms[2], p_res->ttd_ms[3],
+               100.0 * p_res->window_found, (unsigned long long)p_res->collisions);
+    }
+
+    free(m_combos);
+    free(m_results);
+    return 0;
+}
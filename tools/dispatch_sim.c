@@ -0,0 +1,440 @@
+/**@file
+ *
+ * @brief Host model of the SoftDevice event dispatch models, interrupt against polled.
+ *
+ * One CPU serves advertising report events and the log output they cause. Events arrive at
+ * random (Poisson) at the report rate and each costs the handler time. Every event adds log
+ * entries at the given mean rate, each costing the log entry time (formatting and handing it to
+ * the backend).
+ *
+ * Interrupt model (NRF_SDH_DISPATCH_MODEL_INTERRUPT): an event is handled as soon as the CPU is
+ * not handling another one, preempting the log flush in the main loop.
+ *
+ * Polled model (NRF_SDH_DISPATCH_MODEL_POLLING, sd_evts_poll in main.c): each main loop
+ * iteration dispatches up to the event budget, then processes up to the log budget without being
+ * preempted. The loop sleeps once neither budget was used up and nothing is pending.
+ *
+ * Events wait in a queue of the SoftDevice queue depth and are dropped when it is full; log
+ * entries likewise in a queue of the log buffer depth. Event latency is from arrival to the
+ * start of the handler, log latency from the end of the handler to the end of the entry's
+ * output. Scheduler work, interrupt entry and SoC events are not modelled.
+ *
+ * The stamped latency is the event latency as the firmware's own timestamps show it. Interrupt
+ * dispatch stamps an event when its handler starts, so it shows none. Polled dispatch stamps
+ * every event fetched in an iteration with the time the oldest pending event was signalled, as
+ * sd_evts_poll does: events signalled during the iteration are stamped early, events left over
+ * when the budget ran out with the time it ran out.
+ *
+ * Options, the rate is "value" or "first:last:step":
+ *   -r report rate, reports/s            -c handler time per event, us
+ *   -l log entries per event, percent    -o time per log entry, us
+ *   -e event budget (POLL_EVT_BUDGET)    -b log budget (POLL_LOG_BUDGET)
+ *   -q SoftDevice event queue depth      -k log queue depth
+ *   -t simulated time per rate, s
+ *
+ * Prints one CSV line per rate and model.
+ *
+ * Build: cc -O2 -o dispatch_sim dispatch_sim.c -lm
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define QUEUE_MAX 4096 /* Deepest event or log queue accepted. */
+
+/* Parameter range, first to last inclusive. */
+typedef struct
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t step;
+} range_t;
+
+/* FIFO of timestamps, in nanoseconds. */
+typedef struct
+{
+    uint64_t ts[QUEUE_MAX];
+    uint32_t head;
+    uint32_t count;
+    uint32_t depth;
+} queue_t;
+
+/* Latencies of one run, in nanoseconds. */
+typedef struct
+{
+    uint64_t * p_ns;
+    size_t     count;
+    size_t     max;
+} samples_t;
+
+typedef struct
+{
+    uint32_t handler_ns;
+    uint32_t log_ns;
+    uint32_t log_permille;  /* Log entries per thousand events. */
+    uint32_t evt_budget;
+    uint32_t log_budget;
+    uint32_t evt_depth;
+    uint32_t log_depth;
+    uint64_t sim_ns;
+} sim_config_t;
+
+typedef struct
+{
+    uint64_t  offered;
+    uint64_t  dropped;
+    uint64_t  logs;
+    uint64_t  logs_dropped;
+    uint64_t  busy_ns;
+    samples_t evt_latency;
+    samples_t evt_stamped;
+    samples_t log_latency;
+} sim_result_t;
+
+/* Defaults: main.c's budgets; the handler and log times are typical of the deferred report path
+ * and a short deferred log line. */
+static sim_config_t m_config =
+{
+    .handler_ns   = 25000,
+    .log_ns       = 150000,
+    .log_permille = 500,
+    .evt_budget   = 8,
+    .log_budget   = 4,
+    .evt_depth    = 8,
+    .log_depth    = 64,
+    .sim_ns       = 10000000000ULL,
+};
+
+/* State of one run. */
+typedef struct
+{
+    uint64_t       now;
+    uint64_t       next_arrival;
+    uint64_t       rand;
+    uint32_t       log_acc;      /* Log entries owed, in thousandths. */
+    uint64_t       signal_ts;    /* Polled: oldest event signalled and not yet fetched. */
+    bool           signalled;
+    uint64_t       stamp_ts;     /* Timestamp given to the events of this iteration, 0 for dispatch time. */
+    double         mean_gap_ns;
+    queue_t        events;
+    queue_t        logs;
+    sim_result_t * p_res;
+} sim_t;
+
+/* xorshift64*, seeded per rate. */
+static uint64_t rand_next(uint64_t * p_state)
+{
+    *p_state ^= *p_state >> 12;
+    *p_state ^= *p_state << 25;
+    *p_state ^= *p_state >> 27;
+    return *p_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t gap_draw(sim_t * p_sim)
+{
+    double u = ((rand_next(&p_sim->rand) >> 11) + 1.0) / 9007199254740993.0;
+
+    return (uint64_t)(-log(u) * p_sim->mean_gap_ns);
+}
+
+static bool queue_push(queue_t * p_queue, uint64_t ts)
+{
+    if (p_queue->count == p_queue->depth)
+    {
+        return false;
+    }
+    p_queue->ts[(p_queue->head + p_queue->count++) % QUEUE_MAX] = ts;
+    return true;
+}
+
+static uint64_t queue_pop(queue_t * p_queue)
+{
+    uint64_t ts = p_queue->ts[p_queue->head];
+
+    p_queue->head = (p_queue->head + 1) % QUEUE_MAX;
+    p_queue->count--;
+    return ts;
+}
+
+static void sample_add(samples_t * p_samples, uint64_t ns)
+{
+    if (p_samples->count == p_samples->max)
+    {
+        size_t     max   = (p_samples->max > 0) ? 2 * p_samples->max : 4096;
+        uint64_t * p_new = realloc(p_samples->p_ns, max * sizeof(uint64_t));
+
+        if (p_new == NULL)
+        {
+            return;
+        }
+        p_samples->p_ns = p_new;
+        p_samples->max  = max;
+    }
+    p_samples->p_ns[p_samples->count++] = ns;
+}
+
+/* Queues the events that arrived up to now, in order. */
+static void arrivals_admit(sim_t * p_sim)
+{
+    while (p_sim->next_arrival <= p_sim->now)
+    {
+        p_sim->p_res->offered++;
+        if (!queue_push(&p_sim->events, p_sim->next_arrival))
+        {
+            p_sim->p_res->dropped++;
+        }
+        else if (!p_sim->signalled)
+        {
+            p_sim->signal_ts = p_sim->next_arrival;
+            p_sim->signalled = true;
+        }
+        p_sim->next_arrival += gap_draw(p_sim);
+    }
+}
+
+/* Runs the handler of the oldest event and queues its log entries. */
+static void event_handle(sim_t * p_sim)
+{
+    sample_add(&p_sim->p_res->evt_latency, p_sim->now - queue_pop(&p_sim->events));
+    sample_add(&p_sim->p_res->evt_stamped, (p_sim->stamp_ts > 0) ? p_sim->now - p_sim->stamp_ts : 0);
+    p_sim->now += m_config.handler_ns;
+    p_sim->p_res->busy_ns += m_config.handler_ns;
+
+    for (p_sim->log_acc += m_config.log_permille; p_sim->log_acc >= 1000; p_sim->log_acc -= 1000)
+    {
+        p_sim->p_res->logs++;
+        if (!queue_push(&p_sim->logs, p_sim->now))
+        {
+            p_sim->p_res->logs_dropped++;
+        }
+    }
+}
+
+static void log_done(sim_t * p_sim)
+{
+    sample_add(&p_sim->p_res->log_latency, p_sim->now - queue_pop(&p_sim->logs));
+}
+
+static void interrupt_run(sim_t * p_sim)
+{
+    uint64_t log_left = 0; /* Output time left of the oldest log entry, 0 if not started. */
+
+    while (p_sim->now < m_config.sim_ns)
+    {
+        arrivals_admit(p_sim);
+        if (p_sim->events.count > 0)
+        {
+            event_handle(p_sim);
+        }
+        else if (p_sim->logs.count > 0)
+        {
+            // The flush runs until the entry is out or the next event preempts it.
+            uint64_t left = (log_left > 0) ? log_left : m_config.log_ns;
+            uint64_t run  = p_sim->next_arrival - p_sim->now;
+
+            if (run >= left)
+            {
+                run      = left;
+                log_left = 0;
+            }
+            else
+            {
+                log_left = left - run;
+            }
+            p_sim->now += run;
+            p_sim->p_res->busy_ns += run;
+            if (log_left == 0)
+            {
+                log_done(p_sim);
+            }
+        }
+        else
+        {
+            p_sim->now = p_sim->next_arrival;
+        }
+    }
+}
+
+static void polled_run(sim_t * p_sim)
+{
+    while (p_sim->now < m_config.sim_ns)
+    {
+        uint32_t events = 0;
+        uint32_t logs   = 0;
+
+        arrivals_admit(p_sim);
+        p_sim->stamp_ts  = p_sim->signalled ? p_sim->signal_ts : p_sim->now;
+        p_sim->signalled = false;
+        while ((events < m_config.evt_budget) && (p_sim->events.count > 0))
+        {
+            event_handle(p_sim);
+            arrivals_admit(p_sim);
+            events++;
+        }
+        if (events == m_config.evt_budget)
+        {
+            if (!p_sim->signalled)
+            {
+                p_sim->signal_ts = p_sim->now;
+                p_sim->signalled = true;
+            }
+        }
+        else
+        {
+            // Found empty: every event signalled up to now has been fetched.
+            p_sim->signalled = false;
+        }
+        while ((logs < m_config.log_budget) && (p_sim->logs.count > 0))
+        {
+            p_sim->now += m_config.log_ns;
+            p_sim->p_res->busy_ns += m_config.log_ns;
+            log_done(p_sim);
+            logs++;
+        }
+
+        // An event that arrived meanwhile has set the event register, WFE returns at once.
+        arrivals_admit(p_sim);
+        if ((p_sim->events.count == 0) && (p_sim->logs.count == 0))
+        {
+            p_sim->now = p_sim->next_arrival;
+        }
+    }
+}
+
+static int u64_compare(void const * p_a, void const * p_b)
+{
+    uint64_t a = *(uint64_t const *)p_a;
+    uint64_t b = *(uint64_t const *)p_b;
+
+    return (a > b) - (a < b);
+}
+
+/* Percentile of the samples, in microseconds. */
+static double percentile_us(samples_t const * p_samples, uint32_t permille)
+{
+    if (p_samples->count == 0)
+    {
+        return 0;
+    }
+    size_t index = (p_samples->count - 1) * permille / 1000;
+
+    return p_samples->p_ns[index] / 1000.0;
+}
+
+static void result_print(char const * p_model, uint32_t rate, sim_result_t * p_res)
+{
+    samples_t * p_evt     = &p_res->evt_latency;
+    samples_t * p_stamped = &p_res->evt_stamped;
+    samples_t * p_log     = &p_res->log_latency;
+
+    qsort(p_evt->p_ns, p_evt->count, sizeof(uint64_t), u64_compare);
+    qsort(p_stamped->p_ns, p_stamped->count, sizeof(uint64_t), u64_compare);
+    qsort(p_log->p_ns, p_log->count, sizeof(uint64_t), u64_compare);
+    printf("%s,%u,%llu,%.2f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%.1f\n",
+           p_model, rate, (unsigned long long)p_res->offered,
+           (p_res->offered > 0) ? 100.0 * p_res->dropped / p_res->offered : 0.0,
+           percentile_us(p_evt, 500), percentile_us(p_evt, 990), percentile_us(p_evt, 1000),
+           percentile_us(p_stamped, 990),
+           percentile_us(p_log, 990), percentile_us(p_log, 1000),
+           (p_res->logs > 0) ? 100.0 * p_res->logs_dropped / p_res->logs : 0.0,
+           100.0 * p_res->busy_ns / m_config.sim_ns);
+}
+
+static void rate_simulate(uint32_t rate, bool polled)
+{
+    static sim_t sim;
+    sim_result_t res = {0};
+
+    memset(&sim, 0, sizeof(sim));
+    sim.rand         = 0x9E3779B97F4A7C15ULL ^ rate; // Same arrivals for both models.
+    sim.mean_gap_ns  = 1e9 / rate;
+    sim.events.depth = m_config.evt_depth;
+    sim.logs.depth   = m_config.log_depth;
+    sim.p_res        = &res;
+    sim.next_arrival = gap_draw(&sim);
+
+    if (polled)
+    {
+        polled_run(&sim);
+    }
+    else
+    {
+        interrupt_run(&sim);
+    }
+    result_print(polled ? "polled" : "interrupt", rate, &res);
+    free(res.evt_latency.p_ns);
+    free(res.evt_stamped.p_ns);
+    free(res.log_latency.p_ns);
+}
+
+static bool range_parse(char const * p_arg, range_t * p_range)
+{
+    unsigned first, last, step;
+    int      fields = sscanf(p_arg, "%u:%u:%u", &first, &last, &step);
+
+    if (fields == 1)
+    {
+        *p_range = (range_t){first, first, 1};
+        return true;
+    }
+    if ((fields == 3) && (step > 0) && (last >= first))
+    {
+        *p_range = (range_t){first, last, step};
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char ** argv)
+{
+    range_t rate = {1000, 10000, 1000};
+    int     opt;
+    bool    ok = true;
+
+    while ((opt = getopt(argc, argv, "r:c:l:o:e:b:q:k:t:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': ok = range_parse(optarg, &rate); break;
+            case 'c': m_config.handler_ns   = (uint32_t)(strtod(optarg, NULL) * 1000); break;
+            case 'l': m_config.log_permille = (uint32_t)(strtod(optarg, NULL) * 10); break;
+            case 'o': m_config.log_ns       = (uint32_t)(strtod(optarg, NULL) * 1000); break;
+            case 'e': m_config.evt_budget   = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'b': m_config.log_budget   = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'q': m_config.evt_depth    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'k': m_config.log_depth    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 't': m_config.sim_ns       = strtoull(optarg, NULL, 0) * 1000000000ULL; break;
+            default:  ok = false; break;
+        }
+        if (!ok)
+        {
+            fprintf(stderr,
+                    "usage: %s [-r rate] [-c handler_us] [-l logs_pct] [-o log_us] [-e evt_budget]\n"
+                    "       [-b log_budget] [-q evt_depth] [-k log_depth] [-t sim_s]\n"
+                    "       rate: value or first:last:step\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((rate.first == 0) || (m_config.handler_ns == 0) || (m_config.evt_budget == 0) ||
+        (m_config.log_budget == 0) || (m_config.sim_ns == 0) ||
+        (m_config.evt_depth == 0) || (m_config.evt_depth > QUEUE_MAX) ||
+        (m_config.log_depth == 0) || (m_config.log_depth > QUEUE_MAX))
+    {
+        fprintf(stderr, "rate, handler time, budgets and simulated time must be non-zero, "
+                        "queue depths 1 to %u\n", QUEUE_MAX);
+        return 1;
+    }
+
+    printf("model,rate,events,dropped_pct,evt_p50_us,evt_p99_us,evt_max_us,stamped_p99_us,"
+           "log_p99_us,log_max_us,log_dropped_pct,busy_pct\n");
+    for (uint32_t r = rate.first; r <= rate.last; r += rate.step)
+    {
+        rate_simulate(r, false);
+        rate_simulate(r, true);
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/**@file
+ *
+ * @brief Host decoder for the scanner's binary report stream.
+ *
+ * Prints one CSV line per report read on stdin. By default stdin is a capture of the scanner's
+ * log output: records are the log lines starting with '@', a line sequence number in hex and ':',
+ * followed by one or more records in hex, all other lines are ignored. A gap in the sequence
+ * means a line was lost: the decoder forgets the time base and the dictionary, timestamps are
+ * marked with '~' and unannounced devices skipped until the scanner's next resync. With -b stdin is the raw RTT report channel, for example
+ * the output of rtt_dump. A record is a frame preceded by its length as a varint.
+ *
+ * Build: cc -O2 -I.. -o report_decode report_decode.c ../report_codec.c
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "report_codec.h"
+
+#define LINE_RECORDS_MAX            4096 /* Bytes of records accepted on one '@' line. */
+
+#define AD_TYPE_SHORT_LOCAL_NAME    0x08
+#define AD_TYPE_COMPLETE_LOCAL_NAME 0x09
+
+static int hex_nibble(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int hex_parse(char const * p_hex, uint8_t * p_out, int max_len)
+{
+    int len = 0;
+
+    while (len < max_len)
+    {
+        int hi = hex_nibble(p_hex[0]);
+        int lo = (hi < 0) ? -1 : hex_nibble(p_hex[1]);
+        if (lo < 0)
+        {
+            break;
+        }
+        p_out[len++] = (uint8_t)((hi << 4) | lo);
+        p_hex += 2;
+    }
+
+    return len;
+}
+
+/* Copies the (complete or short) local name out of the advertising data. */
+static void name_get(uint8_t const * p_data, uint8_t len, char * p_name, size_t name_size)
+{
+    uint8_t pos = 0;
+
+    p_name[0] = '\0';
+    while (pos + 1 < len)
+    {
+        uint8_t field_len = p_data[pos];
+        uint8_t type      = p_data[pos + 1];
+
+        if (field_len == 0 || pos + 1 + field_len > len)
+        {
+            break;
+        }
+        if (type == AD_TYPE_COMPLETE_LOCAL_NAME || type == AD_TYPE_SHORT_LOCAL_NAME)
+        {
+            size_t n = field_len - 1;
+            if (n >= name_size)
+            {
+                n = name_size - 1;
+            }
+            for (size_t i = 0; i < n; i++)
+            {
+                char c    = (char)p_data[pos + 2 + i];
+                p_name[i] = (isprint((unsigned char)c) && c != ',') ? c : '?';
+            }
+            p_name[n] = '\0';
+            if (type == AD_TYPE_COMPLETE_LOCAL_NAME)
+            {
+                return;
+            }
+        }
+        pos += field_len + 1;
+    }
+}
+
+static void frame_print(report_decoder_t * p_dec, uint8_t const * p_frame, uint16_t len)
+{
+    static char const * const type_str[] = {"?", "sync", "dev", "rpt"};
+    uint8_t      type;
+    report_rec_t rec;
+    char         name[64];
+
+    if (!report_decode(p_dec, p_frame, len, &type, &rec))
+    {
+        fprintf(stderr, "malformed frame (%u bytes)\n", len);
+        return;
+    }
+    if (type == REPORT_FRAME_SYNC)
+    {
+        printf("%u,sync,,,,,,\n", rec.ts);
+        return;
+    }
+    if (rec.index != REPORT_CODEC_INDEX_NONE && !p_dec->known[rec.index])
+    {
+        // Joined mid-stream, the device is announced again at the next resync.
+        return;
+    }
+
+    name_get(rec.p_data, rec.data_len, name, sizeof(name));
+    printf("%s%u,%s,%u,%02x:%02x:%02x:%02x:%02x:%02x,%u,%d,%s,%s\n",
+           p_dec->synced ? "" : "~",
+           rec.ts,
+           type_str[type],
+           rec.index,
+           rec.addr[5], rec.addr[4], rec.addr[3], rec.addr[2], rec.addr[1], rec.addr[0],
+           rec.addr_type,
+           rec.rssi,
+           (rec.phy == REPORT_CODEC_PHY_CODED) ? "coded" : "1m",
+           name);
+}
+
+/* Reads one length-prefixed frame of the RTT channel. Returns the frame length or -1 at EOF. */
+static int binary_frame_read(FILE * p_file, uint8_t * p_frame)
+{
+    uint32_t len   = 0;
+    int      shift = 0;
+    int      c;
+
+    do
+    {
+        c = fgetc(p_file);
+        if (c == EOF || shift > 14)
+        {
+            return -1;
+        }
+        len |= (uint32_t)(c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    if (len > REPORT_CODEC_FRAME_MAX || fread(p_frame, 1, len, p_file) != len)
+    {
+        return -1;
+    }
+
+    return (int)len;
+}
+
+int main(int argc, char ** argv)
+{
+    static report_decoder_t dec;
+    static char             line[2 * LINE_RECORDS_MAX + 64];
+    static uint8_t          records[LINE_RECORDS_MAX];
+    uint8_t                 frame[REPORT_CODEC_FRAME_MAX];
+    bool                    binary = (argc > 1 && strcmp(argv[1], "-b") == 0);
+    int                     len;
+    int                     next_seq = -1; /* Expected line sequence number, -1 before the first. */
+
+    report_decoder_init(&dec);
+    printf("ts_us,frame,index,addr,addr_type,rssi,phy,name\n");
+
+    if (binary)
+    {
+        while ((len = binary_frame_read(stdin, frame)) >= 0)
+        {
+            frame_print(&dec, frame, (uint16_t)len);
+        }
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        if (line[0] != '@')
+        {
+            continue;
+        }
+
+        uint8_t seq;
+        if (hex_parse(&line[1], &seq, 1) != 1 || line[3] != ':')
+        {
+            fprintf(stderr, "record line without a sequence number\n");
+            continue;
+        }
+        if (next_seq >= 0 && seq != next_seq)
+        {
+            fprintf(stderr, "%u record lines lost\n", (uint8_t)(seq - next_seq));
+            report_decoder_init(&dec);
+        }
+        next_seq = (uint8_t)(seq + 1);
+
+        len = hex_parse(&line[4], records, sizeof(records));
+
+        uint8_t const * p_pos = records;
+        uint8_t const * p_frame;
+        uint16_t        frame_len;
+        while (report_record_get(&p_pos, &records[len], &p_frame, &frame_len))
+        {
+            frame_print(&dec, p_frame, frame_len);
+        }
+        if (p_pos != &records[len])
+        {
+            fprintf(stderr, "truncated record line\n");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+/**@file
+ *
+ * @brief Host stress test of the report ring, report_ring.h.
+ *
+ * A producer thread stands in for the SoftDevice event handler and a consumer thread for the
+ * main loop. The producer offers a numbered sequence of reports and fills each slot it gets with
+ * its number; the consumer checks every slot it reads. The run fails if:
+ *
+ *  - reports arrive out of order, or a slot is read torn or before it was committed,
+ *  - a report is missing that did not overflow: the reports received and the overflows must add
+ *    up to the reports offered, and every gap in the sequence must be an overflow,
+ *  - the ring's overflow counter differs from the overflows the producer saw.
+ *
+ * In the first pass the producer waits for a free slot, so nothing may overflow. In the others it
+ * drops reports on a full ring, as the firmware does, while the consumer runs with pauses that
+ * let the ring fill up.
+ *
+ * With two CPUs or more the threads are pinned to separate cores and run flat out, so the
+ * indexes are hammered from both sides at once. On a single CPU the producer yields every
+ * YIELD_EVERY reports instead, which only interleaves the threads at those points.
+ *
+ * The test checks the ring's index logic, not its barriers: the host barrier is a full fence and
+ * x86 keeps stores in order anyway, so a missing REPORT_RING_BARRIER() in report_ring.h would not
+ * fail here. The firmware's __DMB() placement is checked by review, not by this test.
+ *
+ * Options: -n reports per pass (default 10000000).
+ *
+ * Build: cc -O2 -pthread -DREPORT_RING_HOST -I.. -o report_ring_stress report_ring_stress.c
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "report_ring.h"
+
+#define RING_SIZE    8  /* Slots, as small as possible to make the indexes wrap often. */
+#define SLOT_WORDS   16 /* Words of a slot, all set to the report number. */
+#define YIELD_EVERY  97 /* Reports between producer yields, on a single CPU. */
+
+typedef struct
+{
+    uint32_t words[SLOT_WORDS];
+} slot_t;
+
+/* One pass: the consumer pauses every pause_every reports, 0 for never. */
+typedef struct
+{
+    char const * p_name;
+    bool         producer_waits; /* Wait for a free slot instead of overflowing. */
+    uint32_t     pause_every;
+    uint32_t     pause_spins;
+} pass_t;
+
+REPORT_RING_DEF(m_ring, RING_SIZE);
+static slot_t   m_slots[RING_SIZE];
+static uint64_t m_reports;          /* Reports offered per pass, numbered in 32 bits. */
+static uint64_t m_producer_overflows;
+static volatile bool m_producer_done;
+static bool     m_pinned;           /* Threads pinned to separate CPUs, no forced yields. */
+static cpu_set_t m_producer_cpu;
+
+static void * producer(void * p_context)
+{
+    pass_t const * p_pass = p_context;
+
+    for (uint64_t seq = 0; seq < m_reports; seq++)
+    {
+        uint32_t index;
+
+        if (!m_pinned && (seq % YIELD_EVERY == 0))
+        {
+            sched_yield();
+        }
+        while (p_pass->producer_waits && !report_ring_free_slot(&m_ring, &index))
+        {
+            sched_yield();
+        }
+        if (!report_ring_write_slot(&m_ring, &index))
+        {
+            m_producer_overflows++;
+            continue;
+        }
+        for (int i = 0; i < SLOT_WORDS; i++)
+        {
+            m_slots[index].words[i] = (uint32_t)seq;
+        }
+        report_ring_commit(&m_ring);
+    }
+    __atomic_store_n(&m_producer_done, true, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void spin(uint32_t count)
+{
+    for (volatile uint32_t i = 0; i < count; i++)
+    {
+    }
+}
+
+static bool pass_run(pass_t const * p_pass)
+{
+    pthread_t      thread;
+    pthread_attr_t attr;
+    uint64_t       received = 0;
+    uint64_t       gaps     = 0;
+    uint64_t       errors   = 0;
+    uint32_t       expected = 0; /* Next report number if nothing overflows. */
+
+    memset(&m_ring, 0, sizeof(m_ring));
+    m_ring.mask          = RING_SIZE - 1;
+    m_producer_overflows = 0;
+    m_producer_done      = false;
+
+    pthread_attr_init(&attr);
+    if (m_pinned)
+    {
+        pthread_attr_setaffinity_np(&attr, sizeof(m_producer_cpu), &m_producer_cpu);
+    }
+    if (pthread_create(&thread, &attr, producer, (void *)p_pass) != 0)
+    {
+        fprintf(stderr, "cannot start the producer\n");
+        return false;
+    }
+    pthread_attr_destroy(&attr);
+
+    for (;;)
+    {
+        uint32_t index;
+
+        if (!report_ring_read_slot(&m_ring, &index))
+        {
+            // The producer sets done after its last commit: an empty ring after that is final.
+            if (__atomic_load_n(&m_producer_done, __ATOMIC_ACQUIRE) && (report_ring_count(&m_ring) == 0))
+            {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+
+        uint32_t seq = m_slots[index].words[0];
+
+        for (int i = 1; i < SLOT_WORDS; i++)
+        {
+            if (m_slots[index].words[i] != seq)
+            {
+                errors++;
+                break;
+            }
+        }
+        if (seq < expected)
+        {
+            errors++;
+        }
+        else
+        {
+            gaps += seq - expected;
+        }
+        expected = seq + 1;
+        received++;
+        report_ring_release(&m_ring);
+
+        if ((p_pass->pause_every > 0) && (received % p_pass->pause_every == 0))
+        {
+            spin(p_pass->pause_spins);
+        }
+    }
+    pthread_join(thread, NULL);
+
+    // Reports dropped at the end of the sequence are overflows too.
+    gaps += m_reports - expected;
+
+    bool ok = (errors == 0) &&
+              (received + m_producer_overflows == m_reports) &&
+              (gaps == m_producer_overflows) &&
+              (m_ring.overflows == m_producer_overflows) &&
+              (m_ring.high_water <= RING_SIZE);
+
+    printf("%-8s %s: %llu received, %llu overflows (ring %u), %llu gaps, %llu bad slots, high water %u of %u\n",
+           p_pass->p_name, ok ? "ok  " : "FAIL",
+           (unsigned long long)received, (unsigned long long)m_producer_overflows, m_ring.overflows,
+           (unsigned long long)gaps, (unsigned long long)errors, m_ring.high_water, RING_SIZE);
+    return ok;
+}
+
+/* Pins the consumer (this thread) and the producer to the first two CPUs it may run on, if any. */
+static void pin_threads(void)
+{
+    cpu_set_t allowed;
+    cpu_set_t consumer_cpu;
+    int       cpus[2];
+    int       found = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+    {
+        for (int cpu = 0; (cpu < CPU_SETSIZE) && (found < 2); cpu++)
+        {
+            if (CPU_ISSET(cpu, &allowed))
+            {
+                cpus[found++] = cpu;
+            }
+        }
+    }
+    if (found == 2)
+    {
+        CPU_ZERO(&consumer_cpu);
+        CPU_SET(cpus[0], &consumer_cpu);
+        CPU_ZERO(&m_producer_cpu);
+        CPU_SET(cpus[1], &m_producer_cpu);
+        m_pinned = (pthread_setaffinity_np(pthread_self(), sizeof(consumer_cpu), &consumer_cpu) == 0);
+    }
+    if (m_pinned)
+    {
+        printf("consumer on CPU %d, producer on CPU %d\n", cpus[0], cpus[1]);
+    }
+    else
+    {
+        printf("single CPU: the producer yields every %d reports\n", YIELD_EVERY);
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    static pass_t const passes[] =
+    {
+        {"lossless", true, 0, 0},
+        {"flat-out", false, 0, 0},
+        {"bursty", false, 64, 20000},
+        {"slow", false, 1, 200},
+    };
+    bool ok = true;
+    int  opt;
+
+    m_reports = 10000000;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n': m_reports = strtoull(optarg, NULL, 0); break;
+            default:  m_reports = 0; break;
+        }
+        if ((m_reports == 0) || (m_reports > UINT32_MAX))
+        {
+            fprintf(stderr, "usage: %s [-n reports, 1 to 2^32 - 1]\n", argv[0]);
+            return 1;
+        }
+    }
+    pin_threads();
+    for (size_t i = 0; i < sizeof(passes) / sizeof(passes[0]); i++)
+    {
+        ok &= pass_run(&passes[i]);
+    }
+    return ok ? 0 : 1;
+}
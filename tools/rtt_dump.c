@@ -0,0 +1,166 @@
+/**@file
+ *
+ * @brief Host stand-in for an RTT reader working on a memory image.
+ *
+ * Locates the SEGGER RTT control block in a RAM image of the target, for example one saved with
+ * "nrfjprog --readram" or J-Link "savebin", and writes the unread bytes of one up-buffer to
+ * stdout. Pipe the report channel into "report_decode -b" to decode it without a probe.
+ *
+ * Usage: rtt_dump <image> <image base address> [channel]
+ *        rtt_dump <image> <image base address> -l     lists the up-buffers
+ *
+ * Build: cc -O2 -o rtt_dump rtt_dump.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define RTT_ID            "SEGGER RTT"
+#define RTT_ID_LEN        16 /* acID field of SEGGER_RTT_CB. */
+#define RTT_BUFFER_DESC   24 /* sName, pBuffer, SizeOfBuffer, WrOff, RdOff, Flags. */
+#define DEFAULT_CHANNEL   1  /* REPORT_RTT_CHANNEL. */
+
+static uint8_t * m_image;
+static size_t    m_image_len;
+static uint32_t  m_base;
+
+static uint32_t u32_get(size_t offset)
+{
+    return (uint32_t)m_image[offset]
+         | ((uint32_t)m_image[offset + 1] << 8)
+         | ((uint32_t)m_image[offset + 2] << 16)
+         | ((uint32_t)m_image[offset + 3] << 24);
+}
+
+/* Converts a target address to an image offset. Returns 0 if it is outside of the image. */
+static int addr_to_offset(uint32_t addr, uint32_t len, size_t * p_offset)
+{
+    if (addr < m_base || (size_t)(addr - m_base) + len > m_image_len)
+    {
+        return 0;
+    }
+    *p_offset = addr - m_base;
+    return 1;
+}
+
+static long control_block_find(void)
+{
+    for (size_t i = 0; i + RTT_ID_LEN + 8 <= m_image_len; i += 4)
+    {
+        if (memcmp(&m_image[i], RTT_ID, sizeof(RTT_ID)) == 0)
+        {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static void channel_name_get(uint32_t addr, char * p_name, size_t size)
+{
+    size_t offset;
+
+    p_name[0] = '\0';
+    if (addr == 0 || !addr_to_offset(addr, 1, &offset))
+    {
+        return;
+    }
+    for (size_t i = 0; i + 1 < size && offset + i < m_image_len && m_image[offset + i]; i++)
+    {
+        p_name[i]     = (char)m_image[offset + i];
+        p_name[i + 1] = '\0';
+    }
+}
+
+int main(int argc, char ** argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <image> <base address> [channel | -l]\n", argv[0]);
+        return 2;
+    }
+
+    FILE * p_file = fopen(argv[1], "rb");
+    if (p_file == NULL)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(p_file, 0, SEEK_END);
+    m_image_len = (size_t)ftell(p_file);
+    fseek(p_file, 0, SEEK_SET);
+    m_image = malloc(m_image_len);
+    if (m_image == NULL || fread(m_image, 1, m_image_len, p_file) != m_image_len)
+    {
+        fprintf(stderr, "cannot read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(p_file);
+    m_base = (uint32_t)strtoul(argv[2], NULL, 0);
+
+    long cb = control_block_find();
+    if (cb < 0)
+    {
+        fprintf(stderr, "no RTT control block in image\n");
+        return 1;
+    }
+
+    uint32_t num_up = u32_get((size_t)cb + RTT_ID_LEN);
+    int      list   = (argc > 3 && strcmp(argv[3], "-l") == 0);
+    uint32_t ch     = (argc > 3 && !list) ? (uint32_t)strtoul(argv[3], NULL, 0) : DEFAULT_CHANNEL;
+
+    for (uint32_t i = 0; i < num_up; i++)
+    {
+        size_t   desc = (size_t)cb + RTT_ID_LEN + 8 + i * RTT_BUFFER_DESC;
+        char     name[32];
+        size_t   buf;
+
+        if (desc + RTT_BUFFER_DESC > m_image_len)
+        {
+            fprintf(stderr, "control block truncated\n");
+            return 1;
+        }
+
+        uint32_t p_name = u32_get(desc);
+        uint32_t p_buf  = u32_get(desc + 4);
+        uint32_t size   = u32_get(desc + 8);
+        uint32_t wr_off = u32_get(desc + 12);
+        uint32_t rd_off = u32_get(desc + 16);
+
+        if (list)
+        {
+            channel_name_get(p_name, name, sizeof(name));
+            fprintf(stderr, "up %u \"%s\": buffer 0x%08x size %u wr %u rd %u\n",
+                    i, name, p_buf, size, wr_off, rd_off);
+            continue;
+        }
+        if (i != ch)
+        {
+            continue;
+        }
+        if (size == 0 || wr_off >= size || rd_off >= size || !addr_to_offset(p_buf, size, &buf))
+        {
+            fprintf(stderr, "up-buffer %u is not configured or not in the image\n", ch);
+            return 1;
+        }
+
+        // Unread data runs from RdOff to WrOff and may wrap around the end of the buffer.
+        if (wr_off >= rd_off)
+        {
+            fwrite(&m_image[buf + rd_off], 1, wr_off - rd_off, stdout);
+        }
+        else
+        {
+            fwrite(&m_image[buf + rd_off], 1, size - rd_off, stdout);
+            fwrite(&m_image[buf], 1, wr_off, stdout);
+        }
+        return 0;
+    }
+
+    if (!list)
+    {
+        fprintf(stderr, "no up-buffer %u\n", ch);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,209 @@
+/**@file
+ *
+ * @brief Host replay of the adaptive scan duty cycle controller.
+ *
+ * Reads the CSV output of report_decode on stdin and runs it through scan_ctrl.c with the
+ * firmware's duty levels, from the table in scan_ctrl.h that main.c uses. The capture is taken
+ * as what a full duty scan sees; at a lower level only the matching share of the reports is
+ * kept, spread evenly. For the run it prints the time spent per level, the mean duty (the
+ * energy proxy) and, per device, how much later than in the capture it is first seen (the
+ * discovery latency). Devices never seen are counted separately.
+ *
+ * Captures made with REPORT_POLICY_ALL and SCAN_ADAPTIVE 0 give the raw report rate; with
+ * dedup each device contributes one report per window and the controller backs off sooner.
+ *
+ * Options: -t tick ms, -q quiet rate, -n new devices to wake, -b quiet ticks to back off.
+ *
+ * Build: cc -O2 -I.. -o scan_ctrl_replay scan_ctrl_replay.c ../scan_ctrl.c
+ */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "scan_ctrl.h"
+
+#define DEVICES_MAX 4096 /* Distinct addresses tracked. */
+
+/* Interval and window of the firmware's reduced levels, from scan_ctrl.h. */
+static struct
+{
+    uint16_t interval;
+    uint16_t window;
+} const m_reduced_duty[SCAN_CTRL_DUTY_LEVELS - 1] = SCAN_CTRL_REDUCED_DUTY;
+
+/* Radio duty per level: level 0 is taken as full duty, the rest window / interval as in main.c. */
+static uint16_t m_duty_permille[SCAN_CTRL_DUTY_LEVELS];
+
+typedef struct
+{
+    char     addr[18];  /* Address as printed by report_decode. */
+    uint64_t first_ts;  /* First report in the capture. */
+    uint64_t seen_ts;   /* First report kept by the replay, 0 if none. */
+} device_t;
+
+static device_t m_devices[DEVICES_MAX];
+static int      m_device_count;
+
+static device_t * device_get(char const * p_addr, uint64_t ts)
+{
+    for (int i = 0; i < m_device_count; i++)
+    {
+        if (strcmp(m_devices[i].addr, p_addr) == 0)
+        {
+            return &m_devices[i];
+        }
+    }
+    if (m_device_count == DEVICES_MAX)
+    {
+        return NULL;
+    }
+
+    device_t * p_dev = &m_devices[m_device_count++];
+    snprintf(p_dev->addr, sizeof(p_dev->addr), "%s", p_addr);
+    p_dev->first_ts = ts;
+    p_dev->seen_ts  = 0;
+    return p_dev;
+}
+
+int main(int argc, char ** argv)
+{
+    scan_ctrl_config_t config =
+    {
+        .p_duty_permille = m_duty_permille,
+        .levels          = SCAN_CTRL_DUTY_LEVELS,
+        .tick_ms         = SCAN_CTRL_DEFAULT_TICK_MS,
+        .quiet_rate      = SCAN_CTRL_DEFAULT_QUIET_RATE,
+        .wake_devices    = SCAN_CTRL_DEFAULT_WAKE_DEVICES,
+        .backoff_ticks   = SCAN_CTRL_DEFAULT_BACKOFF_TICKS,
+    };
+    scan_ctrl_t ctrl;
+    uint64_t    level_ticks[SCAN_CTRL_DUTY_LEVELS] = {0};
+    uint64_t    ticks        = 0;
+    uint64_t    duty_total   = 0;
+    uint32_t    tick_reports = 0;
+    uint32_t    tick_new     = 0;
+    uint32_t    thin         = 0;
+    uint64_t    ts           = 0;
+    uint64_t    tick_end     = 0;
+    uint32_t    last_ts      = 0;
+    bool        started      = false;
+    char        line[512];
+    int         opt;
+
+    while ((opt = getopt(argc, argv, "t:q:n:b:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't': config.tick_ms       = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'q': config.quiet_rate    = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'n': config.wake_devices  = (uint8_t)strtoul(optarg, NULL, 0);  break;
+            case 'b': config.backoff_ticks = (uint8_t)strtoul(optarg, NULL, 0);  break;
+            default:
+                fprintf(stderr, "usage: %s [-t tick_ms] [-q quiet_rate] [-n wake_devices] [-b backoff_ticks]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (config.tick_ms == 0 || config.wake_devices == 0)
+    {
+        fprintf(stderr, "tick and wake devices must be non-zero\n");
+        return 1;
+    }
+    m_duty_permille[0] = 1000;
+    for (int i = 1; i < SCAN_CTRL_DUTY_LEVELS; i++)
+    {
+        m_duty_permille[i] = (uint16_t)((1000UL * m_reduced_duty[i - 1].window) / m_reduced_duty[i - 1].interval);
+    }
+    scan_ctrl_init(&ctrl, &config);
+
+    while (fgets(line, sizeof(line), stdin) != NULL)
+    {
+        char     frame[8];
+        char     addr[18];
+        unsigned raw_ts;
+
+        // Skips the header, sync lines and the reports decoded before the first sync ('~').
+        if (sscanf(line, "%u,%7[^,],%*u,%17[^,]", &raw_ts, frame, addr) != 3)
+        {
+            continue;
+        }
+
+        // Timestamps wrap after about 71 minutes.
+        if (!started)
+        {
+            started  = true;
+            tick_end = config.tick_ms * 1000ULL;
+        }
+        else
+        {
+            ts += (uint32_t)(raw_ts - last_ts);
+        }
+        last_ts = raw_ts;
+
+        while (ts >= tick_end)
+        {
+            duty_total += m_duty_permille[ctrl.level];
+            level_ticks[ctrl.level]++;
+            ticks++;
+            scan_ctrl_tick(&ctrl, tick_reports, tick_new);
+            tick_reports = 0;
+            tick_new     = 0;
+            tick_end    += config.tick_ms * 1000ULL;
+        }
+
+        device_t * p_dev = device_get(addr, ts);
+
+        // Keep the share of the reports the current duty would have caught.
+        thin += m_duty_permille[ctrl.level];
+        if (thin < 1000)
+        {
+            continue;
+        }
+        thin -= 1000;
+
+        tick_reports++;
+        if (p_dev != NULL && p_dev->seen_ts == 0)
+        {
+            p_dev->seen_ts = ts + 1;
+            tick_new++;
+        }
+    }
+
+    if (ticks == 0)
+    {
+        fprintf(stderr, "capture shorter than one tick\n");
+        return 1;
+    }
+
+    printf("ticks: %llu of %u ms, mean duty %.1f%%\n",
+           (unsigned long long)ticks, config.tick_ms, duty_total / (10.0 * ticks));
+    for (unsigned i = 0; i < config.levels; i++)
+    {
+        printf("level %u (%u permille): %.1f%% of the time\n",
+               i, m_duty_permille[i], 100.0 * level_ticks[i] / ticks);
+    }
+
+    uint64_t latency_total = 0;
+    uint64_t latency_max   = 0;
+    int      seen          = 0;
+    for (int i = 0; i < m_device_count; i++)
+    {
+        if (m_devices[i].seen_ts == 0)
+        {
+            continue;
+        }
+        uint64_t latency = m_devices[i].seen_ts - 1 - m_devices[i].first_ts;
+        latency_total += latency;
+        if (latency > latency_max)
+        {
+            latency_max = latency;
+        }
+        seen++;
+    }
+    printf("devices: %d seen, %d missed, discovery delay avg %llu ms, max %llu ms\n",
+           seen, m_device_count - seen,
+           (unsigned long long)(seen > 0 ? latency_total / seen / 1000 : 0),
+           (unsigned long long)(latency_max / 1000));
+
+    return 0;
+}
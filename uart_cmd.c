@@ -0,0 +1,85 @@
+/**@file
+ *
+ * @brief Line based command input on a receive-only UART.
+ */
+#include "sdk_common.h"
+#include "nrf_drv_uart.h"
+#include "app_scheduler.h"
+#include "uart_cmd.h"
+
+static nrf_drv_uart_t     m_uart = NRF_DRV_UART_INSTANCE(1); /**< Command UART. */
+static uart_cmd_handler_t m_handler;                         /**< Application handler. */
+static uint8_t            m_rx_byte;                         /**< Receive buffer of the running transfer. */
+static char               m_line[UART_CMD_LINE_MAX + 1];     /**< Line being assembled. */
+static uint8_t            m_line_len;                        /**< Characters in @ref m_line. */
+static bool               m_line_overflow;                   /**< The line being assembled is too long. */
+static volatile bool      m_line_pending;                    /**< @ref m_line is complete and waiting for the handler. */
+
+static void line_sched_handler(void * p_event_data, uint16_t event_size)
+{
+    m_handler(m_line);
+    m_line_len     = 0;
+    m_line_pending = false;
+}
+
+static void line_byte_put(uint8_t byte)
+{
+    if (m_line_pending)
+    {
+        return;
+    }
+
+    if (byte == '\r' || byte == '\n')
+    {
+        if (m_line_len > 0 && !m_line_overflow)
+        {
+            m_line[m_line_len] = '\0';
+            m_line_pending     = true;
+            if (app_sched_event_put(NULL, 0, line_sched_handler) != NRF_SUCCESS)
+            {
+                m_line_pending = false;
+            }
+        }
+        if (!m_line_pending)
+        {
+            m_line_len = 0;
+        }
+        m_line_overflow = false;
+        return;
+    }
+
+    if (m_line_len < UART_CMD_LINE_MAX)
+    {
+        m_line[m_line_len++] = (char)byte;
+    }
+    else
+    {
+        m_line_overflow = true;
+    }
+}
+
+static void uart_evt_handler(nrf_drv_uart_event_t * p_event, void * p_context)
+{
+    if (p_event->type == NRF_DRV_UART_EVT_RX_DONE)
+    {
+        line_byte_put(m_rx_byte);
+    }
+    // Also after an error: receive the next byte.
+    UNUSED_RETURN_VALUE(nrf_drv_uart_rx(&m_uart, &m_rx_byte, 1));
+}
+
+ret_code_t uart_cmd_init(uart_cmd_handler_t handler)
+{
+    nrf_drv_uart_config_t config = NRF_DRV_UART_DEFAULT_CONFIG;
+    ret_code_t            err_code;
+
+    m_handler       = handler;
+    config.pseltxd  = NRF_UART_PSEL_DISCONNECTED;
+    config.pselrxd  = UART_CMD_RX_PIN;
+    config.baudrate = NRF_UART_BAUDRATE_115200;
+
+    err_code = nrf_drv_uart_init(&m_uart, &config, uart_evt_handler);
+    VERIFY_SUCCESS(err_code);
+
+    return nrf_drv_uart_rx(&m_uart, &m_rx_byte, 1);
+}
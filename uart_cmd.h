@@ -0,0 +1,44 @@
+/**@file
+ *
+ * @brief Line based command input on a receive-only UART.
+ *
+ * @details The log keeps UARTE0 for output; commands are read on UARTE1, one byte per transfer,
+ *          and assembled into lines ended by CR or LF. A complete line is passed to the
+ *          application handler from the main loop through the scheduler. Bytes received while
+ *          the previous line is still waiting for the handler are dropped.
+ */
+#ifndef UART_CMD_H__
+#define UART_CMD_H__
+
+#include <stdint.h>
+#include "sdk_errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef UART_CMD_RX_PIN
+#define UART_CMD_RX_PIN 8  /**< Receive pin, the DK's interface MCU UART output. */
+#endif
+
+#ifndef UART_CMD_LINE_MAX
+#define UART_CMD_LINE_MAX 32 /**< Longest command line, without the terminator. Longer lines are dropped. */
+#endif
+
+/**@brief Command line handler, called in the main loop.
+ *
+ * @param[in] p_line Zero-terminated line, without the line ending. Valid until the handler returns.
+ */
+typedef void (*uart_cmd_handler_t)(char const * p_line);
+
+/**@brief Function for starting to receive commands.
+ *
+ * @param[in] handler Command line handler.
+ */
+ret_code_t uart_cmd_init(uart_cmd_handler_t handler);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UART_CMD_H__